@@ -0,0 +1,72 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "link_layer.h"
+
+// Raw line capture. With LL_CAPTURE=<file> every span the link reads from or
+// writes to its transport is appended to <file> with a monotonic timestamp,
+// before any decoding, so a noisy run can be fed back into a receiver
+// (replay:<file>, bin/replay) or into the decoder alone (bin/decodebench).
+// Further links opened by the same process capture to <file>.2, <file>.3...
+//
+// Format, in host byte order: a t_capture_header, then records made of a
+// uint32 time since the previous record in microseconds, a uint16 holding
+// the direction in its top bit and the size below it, and the bytes.
+#define CAPTURE_MAGIC 0x50434C4C // "LLCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_RECORD_MAX 0x7FFF
+#define CAPTURE_WRITTEN 0x8000
+
+typedef enum
+{
+    CAPTURE_READ,       // Bytes that came in from the peer
+    CAPTURE_WRITE       // Bytes sent to the peer
+}   t_capture_dir;
+
+typedef struct s_capture_header
+{
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    role;       // LinkLayerRole of the side that captured
+    uint32_t    baudRate;
+    uint32_t    reserved;
+    double      start;      // CLOCK_REALTIME when the capture started
+}   t_capture_header;
+
+typedef struct s_capture t_capture;
+
+// Returns NULL (after saying why) if the file can't be created
+t_capture   *captureOpen(const char *path, LinkLayerRole role, int baudRate);
+// Safe to call from several threads, and with a NULL capture
+void        captureBytes(t_capture *c, t_capture_dir dir, const uint8_t *bytes, size_t size);
+int         captureClose(t_capture *c);
+
+typedef struct s_capture_reader
+{
+    FILE                *file;
+    t_capture_header    header;
+    double              time;   // Of the last record, seconds since the start
+}   t_capture_reader;
+
+typedef struct s_capture_record
+{
+    t_capture_dir   dir;
+    double          time;
+    size_t          size;
+    uint8_t         bytes[CAPTURE_RECORD_MAX];
+}   t_capture_record;
+
+int     captureReaderOpen(t_capture_reader *r, const char *path);
+// Returns 1 with the next record, 0 at the end of the capture, -1 if it's cut short
+int     captureNext(t_capture_reader *r, t_capture_record *record);
+void    captureReaderClose(t_capture_reader *r);
+
+// The direction a receiver replaying the capture reads: what the receiver
+// read, or what the transmitter wrote
+t_capture_dir captureFeedDir(const t_capture_header *header);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <stdlib.h>
+
+#include "mux.h"
+
+// Optional features are selected through environment variables, since the
+// command line handled by main.c is fixed. LL_TUNE=<file> names a file of
+// NAME=value lines (as written by bin/linktune) that are taken as defaults
+// for the variables that aren't set.
+typedef struct s_config
+{
+    int             mux;        // LL_MUX=rr|prio: interleave several files over logical channels
+    t_mux_policy    muxPolicy;
+    uint8_t         muxPriority[MAX_CHANNELS];  // LL_MUX=prio:<channel>=<priority>,...
+
+    int             batch;      // LL_BATCH=1|coalesce: many files over one connection
+    int             coalesce;   // pack small files whole into shared packets
+    int             resume;     // LL_RESUME=1: ask the receiver where to resume each file
+    int             delta;      // LL_DELTA=1: only send what the receiver's copy lacks
+    int             sparse;     // LL_SPARSE=1: send holes and zero blocks as a length
+    int             sha256;     // LL_DIGEST=sha256: END also carries a SHA-256 of the file
+    int             aggregate;  // LL_AGGREGATE=1: share I-frames between small packets
+    size_t          chunk;      // LL_CHUNK=<bytes>: file data per packet, up to MAX_PAYLOAD_SIZE - 4
+    double          timeout;    // LL_TIMEOUT_MS: replaces the timeout llopen is given, in seconds
+    int             retries;    // LL_RETRIES: replaces its number of retransmissions, -1 if unset
+
+    const char      *duplexSend;    // LL_DUPLEX_SEND: file the receiver sends back
+    const char      *duplexRecv;    // LL_DUPLEX_RECV: where the transmitter stores it
+    double          ackDelay;       // LL_ACK_DELAY_MS: wait for an I-frame to carry an ACK
+    const char      *metricsFile;   // LL_METRICS: llclose exports link metrics (.csv or JSON)
+    const char      *telemetry;     // LL_TELEMETRY: shared memory segment for live counters
+    const char      *capture;       // LL_CAPTURE: file every raw byte read and written goes to
+}   t_config;
+
+const t_config *getConfig(void);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// rsync-style delta encoding. The receiver describes the copy it already
+// has with one signature per DELTA_BLOCK bytes; the sender finds those blocks
+// anywhere in the new file with a rolling weak hash confirmed by a strong
+// hash, and only sends what is not already there.
+
+#define DELTA_BLOCK 512
+
+typedef struct s_delta_sig
+{
+    uint32_t    weak;
+    uint64_t    strong;
+}   t_delta_sig;
+
+typedef struct s_delta_index
+{
+    const t_delta_sig   *sigs;
+    size_t              count;
+    int32_t             *slots;     // Block numbers, -1 for empty slots
+    size_t              mask;
+}   t_delta_index;
+
+uint32_t    deltaWeak(const uint8_t *data, size_t size);
+uint32_t    deltaRoll(uint32_t weak, uint8_t out, uint8_t in, size_t size);
+uint64_t    deltaStrong(const uint8_t *data, size_t size);
+
+// Signatures of every whole block of file, *sigs must be freed by the caller
+int         deltaSignatures(FILE *file, t_delta_sig **sigs, size_t *count);
+
+int         deltaIndexInit(t_delta_index *index, const t_delta_sig *sigs, size_t count);
+// Block of the receiver's copy equal to the DELTA_BLOCK bytes at data, or -1
+long        deltaIndexFind(const t_delta_index *index, uint32_t weak, const uint8_t *data);
+void        deltaIndexFree(t_delta_index *index);
+
+#endif
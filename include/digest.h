@@ -0,0 +1,40 @@
+#ifndef _DIGEST_H_
+#define _DIGEST_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Streaming file digests carried in END packets: CRC32C always, SHA-256
+// when asked for. Both are updated as the data goes through the link.
+
+#define SHA256_SIZE 32
+
+typedef struct s_sha256
+{
+    uint32_t    state[8];
+    uint64_t    length;
+    uint8_t     block[64];
+    size_t      used;
+}   t_sha256;
+
+typedef struct s_digest
+{
+    uint32_t    crc;
+    int         sha;
+    t_sha256    sha256;
+}   t_digest;
+
+uint32_t    crc32c(uint32_t crc, const uint8_t *data, size_t size);
+
+void        sha256Init(t_sha256 *sha);
+void        sha256Update(t_sha256 *sha, const uint8_t *data, size_t size);
+void        sha256Final(t_sha256 *sha, uint8_t out[SHA256_SIZE]);
+
+void        digestInit(t_digest *digest, int sha);
+void        digestUpdate(t_digest *digest, const uint8_t *data, size_t size);
+// Same as digestUpdate over size zero bytes, without touching them for the CRC
+void        digestZeros(t_digest *digest, uint64_t size);
+uint32_t    digestCrc(const t_digest *digest);
+void        digestSha(t_digest *digest, uint8_t out[SHA256_SIZE]);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _FRAME_DECODER_H_
+#define _FRAME_DECODER_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "link_layer.h"
+#include "protocol.h"
+
+// Frame decoder shared by everything that reads the line. It is driven by a
+// (state, byte class) transition table, takes whatever span of bytes the
+// transport returned and hands back the complete frames in it one by one,
+// already destuffed and classified.
+
+typedef enum
+{
+    FRAME_I,        // Information frame, valid tells whether BCC2 matched
+    FRAME_S,        // RR / REJ / RNR
+    FRAME_U,        // SET / UA / DISC and unknown control values
+    FRAME_DAMAGED   // Bad address or BCC1, closed by a FLAG
+}   t_frame_kind;
+
+typedef struct s_decoded_frame
+{
+    t_frame_kind    kind;
+    uint8_t         a;          // 0 when the address itself was damaged
+    uint8_t         c;
+    const uint8_t   *data;      // I-frames: destuffed payload, without BCC2
+    size_t          size;
+    int             valid;
+    size_t          skipped;    // Damaged frames: bytes after the damaged field
+    int             fragment;   // No opening FLAG of its own: the rest of the frame before,
+                                // split by a FLAG that a bit error made up
+}   t_decoded_frame;
+
+typedef struct s_decoder
+{
+    t_state     state;
+    uint8_t     a;
+    uint8_t     c;
+    int         escaped;
+    int         opened;     // A FLAG opened the current frame, not just closed the last one
+    uint8_t     buf[MAX_PAYLOAD_SIZE + 1];  // Destuffed body and BCC2
+    size_t      size;
+}   t_decoder;
+
+void    frameDecoderInit(t_decoder *d);
+
+// Decodes from *bytes (*size of them) until a frame is complete. Returns TRUE
+// with the frame in *frame, whose data stays valid until the next call, or
+// FALSE once the span is used up. *bytes and *size are advanced past what was
+// consumed, so the caller loops until FALSE.
+int     frameDecode(t_decoder *d, const uint8_t **bytes, size_t *size, t_decoded_frame *frame);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _LINK_EXT_H_
+#define _LINK_EXT_H_
+
+#include <stdint.h>
+
+// Link layer extensions on top of link_layer.h (which is fixed).
+
+// Logical channels share one link through the address byte.
+// Channel 0 is the control channel and carries the plain ADDR_SEND / ADDR_RCV address.
+#define MAX_CHANNELS 8
+#define CONTROL_CHANNEL 0
+
+// Send / receive a packet on a given logical channel.
+// Each channel has its own sequence number space.
+int     llwriteChannel(uint8_t channel, const unsigned char *buf, int bufSize);
+int     llreadChannel(unsigned char *packet, uint8_t *channel);
+
+// Transmitter only: redo the SET / UA handshake on an open link and restart
+// the sequence numbers, e.g. after the receiver was restarted. A link whose
+// line failed gets a new reader thread first, and a new connection if the
+// peer hung up.
+// Return "0" on success or "-1" on error.
+int     llreset(void);
+
+// With LL_AGGREGATE set, llwrite keeps small packets back so that several of
+// them share one I-frame; they go out when the frame is full, before a bigger
+// packet, and in llread / llreset / llclose. llflush sends them right away.
+// An error while sending them is returned by the call that flushed them.
+// Return "0" on success or "-1" on error.
+int     llflush(void);
+
+// TRUE once the link failed, llclose started or the transmitter sent DISC.
+int     llclosing(void);
+
+// Counters of the open link (see metrics.h), valid until llclose
+typedef struct s_metrics t_metrics;
+
+const t_metrics *llmetrics(void);
+
+// The link opened by llopen belongs to the calling thread. Other threads of
+// the same endpoint (e.g. the second direction of a duplex transfer) must
+// attach to it before calling llread / llwrite.
+typedef struct s_link t_link;
+
+t_link  *llcurrent(void);
+void    lluse(t_link *link);
+
+#endif
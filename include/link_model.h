@@ -0,0 +1,56 @@
+#ifndef _LINK_MODEL_H_
+#define _LINK_MODEL_H_
+
+#include <stdlib.h>
+
+// Analytic model of the link on a line with independent bit errors, for
+// bin/linktune and the theory column of bin/cablerun.
+//
+// An I-frame of L payload bytes (the packet header included) takes
+// Tf = (L * (1 + s) + 6) * 10 / baud on the line, s being the share of
+// payload bytes that need stuffing and 10 bits per byte (8N1); its answer
+// takes Ta = 5 * 10 / baud. A try fails when either is hit,
+// P = 1 - (1 - ber)^(8 * both sizes), and one cycle lasts K frame times,
+// K = 1 + (Ta + 2 * Tprop) / Tf, the usual 1 + 2a. The ARQ efficiencies are
+// the textbook ones (Stallings): (1 - P) / K for stop-and-wait, and for a
+// window of W frames (1 - P) / (1 + (K - 1) P) or W (1 - P) / (K (1 - P + W P))
+// for go-back-N, 1 - P or W (1 - P) / K for selective repeat. Each failed try
+// is counted as one more cycle, so timeouts make a real line do worse.
+
+#define MODEL_FRAME_OVERHEAD 6      // F A C BCC1 ... BCC2 F
+#define MODEL_ANSWER_SIZE 5
+#define MODEL_BITS_PER_BYTE 10
+
+typedef enum
+{
+    ARQ_STOP_AND_WAIT,
+    ARQ_GO_BACK_N,
+    ARQ_SELECTIVE_REPEAT
+}   t_arq;
+
+typedef struct s_line
+{
+    int     baudRate;
+    double  prop;       // One way propagation delay, seconds
+    double  ber;
+    double  stuffing;   // Escape bytes per payload byte
+}   t_line;
+
+// x to the n-th power, n a whole number, without libm
+double  modelPower(double x, double n);
+
+// Seconds on the line of an I-frame with payload bytes, and of its answer
+double  modelFrameTime(const t_line *line, size_t payload);
+double  modelAnswerTime(const t_line *line);
+// Probability that a try fails
+double  modelFrameError(const t_line *line, size_t payload);
+// Frame times per cycle, 1 + 2a
+double  modelCycle(const t_line *line, size_t payload);
+
+// Share of the line's bit rate that carries payload, between 0 and 0.8
+double  modelEfficiency(const t_line *line, size_t payload, t_arq arq, int window);
+
+// Bit error rate that makes tries of this size fail with probability fer
+double  modelBer(double fer, size_t payload, double stuffing);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+// Leveled logging off the hot path. A message is formatted by the caller into
+// a lock-free ring and written to stdout by a background thread; a full ring
+// drops messages instead of blocking, and they are counted. Repeats of the
+// same message are limited to LOG_BURST per second, the rest are summed up in
+// one line. Whatever is queued is written at exit, and by logFlush, which
+// llopen and llclose call so the log stays in order with what is printed
+// around them.
+//
+// LL_LOG=debug|info|warn|error|off sets the level at run time (info by
+// default). Levels below LOG_LEVEL_MIN are compiled out, for instance with
+// make CFLAGS="-Wall -pthread -DLOG_LEVEL_MIN=LOG_INFO".
+
+typedef enum
+{
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR,
+    LOG_OFF
+}   t_log_level;
+
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN LOG_DEBUG
+#endif
+
+// Messages are told apart by their format string, which should be a literal
+void    logWrite(t_log_level level, const char *func, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+// Takes the message as is, repeats are the messages with the same text
+void    logText(t_log_level level, const char *func, const char *msg);
+// Writes everything queued so far
+void    logFlush(void);
+
+#define LOG_AT(level, ...) do { if ((level) >= LOG_LEVEL_MIN) logWrite((level), __VA_ARGS__); } while (0)
+#define logDebug(...) LOG_AT(LOG_DEBUG, __VA_ARGS__)
+#define logInfo(...) LOG_AT(LOG_INFO, __VA_ARGS__)
+#define logWarn(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#define logError(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "link_layer.h"
+#include "utils.h"
+
+// Link metrics gathered while the link is open and exported by llclose to
+// the file named by LL_METRICS, as JSON or, for a .csv name, as one CSV row
+// per run (the header is written when the file is new).
+
+// Log-linear histogram in the manner of HdrHistogram: values below 32 have a
+// bucket each, above that every power of two is split in 16 buckets, so any
+// value is known within about 6%.
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS ((1 << HIST_SUB_BITS) + (64 - HIST_SUB_BITS) * (1 << (HIST_SUB_BITS - 1)))
+
+typedef struct s_histogram
+{
+    uint64_t    counts[HIST_BUCKETS];
+    uint64_t    count;
+    uint64_t    min;
+    uint64_t    max;
+    double      sum;
+}   t_histogram;
+
+void        histRecord(t_histogram *h, uint64_t value);
+// Highest value that ends up in the same bucket as the p-th percentile
+uint64_t    histPercentile(const t_histogram *h, double p);
+double      histMean(const t_histogram *h);
+
+typedef struct s_metrics
+{
+    LinkLayerRole   role;
+    int             baudRate;
+    double          start;
+
+    t_histogram     frameRtt;       // us, from writing an I-frame to its answer
+    t_histogram     packetLatency;  // us, from llwrite to the ACK, retries included
+    double          srtt;           // us, frame round trip smoothed like TCP's SRTT
+
+    // Retransmissions by cause
+    size_t          retxTimeout;
+    size_t          retxRej;
+    size_t          retxDamaged;    // The answer arrived with a damaged header
+    size_t          retxRnr;        // Polls while the receiver was not ready
+
+    // Sender: I-frames as written, every try included
+    size_t          framesSent;
+    uint64_t        payloadSent;
+    uint64_t        stuffingSent;   // Escape bytes added by stuffing
+    uint64_t        wireSent;       // Everything written, FLAGs and headers included
+    uint64_t        payloadAcked;
+
+    // Receiver: I-frames accepted and handed to llread
+    size_t          framesReceived;
+    uint64_t        payloadReceived;
+}   t_metrics;
+
+// CLOCK_MONOTONIC in seconds
+double      metricsNow(void);
+
+void        metricsInit(t_metrics *m, const LinkLayer *params);
+int         metricsExport(const char *path, const t_metrics *m, const t_statistics *stats);
+// Value of a column of an exported CSV row, by its name in the header, 0 if missing
+double      metricsColumn(const char *header, const char *row, const char *name);
+
+#endif
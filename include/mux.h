@@ -0,0 +1,46 @@
+#ifndef _MUX_H_
+#define _MUX_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "link_ext.h"
+
+// Scheduler deciding which logical channel sends the next frame.
+
+typedef enum
+{
+    MUX_RR,     // Round robin over every channel with queued packets
+    MUX_PRIO    // Highest priority channel first, round robin between equals
+}   t_mux_policy;
+
+typedef struct s_mux_packet
+{
+    uint8_t                 *data;
+    size_t                  size;
+    struct s_mux_packet     *next;
+}   t_mux_packet;
+
+typedef struct s_mux_channel
+{
+    t_mux_packet    *head;
+    t_mux_packet    *tail;
+    size_t          queued;
+    uint8_t         priority;
+}   t_mux_channel;
+
+typedef struct s_mux
+{
+    t_mux_policy    policy;
+    t_mux_channel   channels[MAX_CHANNELS];
+    uint8_t         last;
+}   t_mux;
+
+void    muxInit(t_mux *mux, t_mux_policy policy);
+void    muxSetPriority(t_mux *mux, uint8_t channel, uint8_t priority);
+int     muxEnqueue(t_mux *mux, uint8_t channel, const uint8_t *data, size_t size);
+size_t  muxQueued(t_mux *mux, uint8_t channel);
+int     muxSendNext(t_mux *mux);
+void    muxFree(t_mux *mux);
+
+#endif
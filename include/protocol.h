@@ -23,18 +23,40 @@ typedef enum {
     CTRL_REJ0 = 0x54,
     CTRL_REJ1 = 0x55,
 
+    CTRL_RNR0 = 0x2A,
+    CTRL_RNR1 = 0x2B,
+
     CTRL_DISC = 0x0B,
 
     CTRL_INFO0 = 0x00,
     CTRL_INFO1 = 0x80
 }   t_frame_ctrl;
 
+// I-frames carry N(S) in bit 7 and, piggybacked, the N(R) of the opposite
+// direction in bit 6. Bit 5 marks an aggregate I-frame, whose payload is a run
+// of [lenHi][lenLo][packet] records. Every other control value has some of
+// the low bits set.
+#define INFO_NS 0x80
+#define INFO_NR 0x40
+#define INFO_AGG 0x20
+#define IS_INFO(c) (((c) & 0x1F) == 0)
+
+// Length prefix of each record of an aggregate I-frame
+#define AGG_HEADER 2
+#define INFO_CTRL(ns, nr) ((t_frame_ctrl)(((ns) ? INFO_NS : 0) | ((nr) ? INFO_NR : 0)))
+
 typedef enum
 {
     ADDR_SEND = 0x03,
     ADDR_RCV = 0x01
 }   t_frame_addr;
 
+// Logical channel carried in the high nibble of the address byte.
+// The low nibble keeps ADDR_SEND / ADDR_RCV, so channel 0 is the plain address.
+#define ADDR_CHANNEL(addr, ch) ((t_frame_addr)((addr) | ((ch) << 4)))
+#define ADDR_BASE(a) ((a) & 0x0F)
+#define ADDR_CH(a) ((uint8_t)(a) >> 4)
+
 typedef struct
 {
     t_frame_addr    a;
@@ -57,10 +79,14 @@ typedef enum e_state
     C_RCV,
     BCC_OK,
     DATA_RCV,
+    HDR_ERR,    // Damaged header, skipping to the next FLAG
     STOP
 }   t_state;
 
+t_frame newFrame(t_frame_addr addr, t_frame_ctrl ctrl, uint8_t *data, size_t dataSize);
 t_frame newSUFrame(t_frame_addr addr, t_frame_ctrl ctrl);
+// Stuffed bytes of the frame from FLAG to FLAG, to be freed by the caller
+uint8_t *frameToString(t_frame *frame, size_t *finalSize);
 
 #define SET_Command newSUFrame(ADDR_SEND, CTRL_SET)
 #define UA_Rx_Response newSUFrame(ADDR_SEND, CTRL_UA)
@@ -0,0 +1,70 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+
+// Live transfer counters published in a POSIX shared memory segment named by
+// LL_TELEMETRY, for bin/linkstat or any other monitor to read while the
+// transfer runs. The writer never waits for readers: every update is framed
+// by a sequence counter that is odd while it is in progress, and a reader
+// copies the segment and retries if the counter moved (a seqlock).
+
+#define TELEMETRY_MAGIC 0x4C4C544D // "LLTM"
+#define TELEMETRY_VERSION 1
+
+typedef enum
+{
+    TM_OPEN,
+    TM_CLOSED
+}   t_telemetry_state;
+
+typedef struct s_telemetry
+{
+    uint32_t    magic;          // Written last, once the segment is ready
+    uint32_t    version;
+    uint32_t    seq;            // Odd while an update is in progress
+    int32_t     pid;
+
+    int32_t     role;           // LinkLayerRole
+    int32_t     state;          // t_telemetry_state
+    int32_t     baudRate;
+    uint32_t    rtoMs;          // Retransmission timeout
+    double      start;          // CLOCK_MONOTONIC seconds, like updated
+    double      updated;
+
+    // Link layer
+    uint64_t    payload;        // Acknowledged when sending, read when receiving
+    uint64_t    framesSent;
+    uint64_t    framesReceived;
+    uint64_t    retransmits;
+    uint64_t    errors;
+    uint32_t    srttUs;         // Smoothed frame round trip
+    uint32_t    windowUsed;     // I-frames waiting for their answer
+    uint32_t    windowSize;
+    uint32_t    aggregated;     // Bytes held back to share an I-frame
+    uint32_t    rxQueued;       // I-frames waiting for llread
+    uint32_t    rxQueueSize;
+
+    // Application layer: the file that moved last
+    char        fileName[256];
+    uint64_t    fileSize;       // 0 for a stream, whose size is unknown
+    uint64_t    fileDone;
+    uint32_t    filesDone;
+    int32_t     etaSeconds;     // -1 when unknown
+}   t_telemetry;
+
+// Writer side. telemetryBegin returns NULL when LL_TELEMETRY is unset or the
+// segment couldn't be created, otherwise the fields can be changed until
+// telemetryEnd publishes them.
+t_telemetry *telemetryBegin(void);
+void        telemetryEnd(t_telemetry *t);
+
+// A file starts with done bytes already there (resume), or makes progress
+void        telemetryFile(const char *name, uint64_t size, uint64_t done);
+void        telemetryProgress(uint64_t done);
+void        telemetryFileDone(void);
+
+// Reader side: a consistent copy of the segment, -1 if it kept changing
+int         telemetrySnapshot(const t_telemetry *shared, t_telemetry *copy);
+
+#endif
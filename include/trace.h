@@ -0,0 +1,62 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+// Tracepoints on the hot path, compiled in with -DLL_TRACE (make trace) and
+// to nothing otherwise. Each thread records (stage, start, end) spans into its
+// own ring buffer, timed with the TSC where there is one and
+// CLOCK_MONOTONIC_RAW elsewhere. At exit the rings are written to LL_TRACE_FILE
+// (default trace.bin); bin/tracedump turns that into a Chrome trace.
+
+typedef enum
+{
+    TR_LLWRITE,         // Whole llwrite, from the first try to the ACK
+    TR_FRAME_BUILD,     // BCC2 and stuffing
+    TR_SERIAL_WRITE,    // Transport write of one frame
+    TR_ACK_WAIT,        // Waiting for RR / REJ / RNR after a frame
+    TR_RETRANSMIT,      // Instant: a frame is sent again
+    TR_LLREAD_WAIT,     // llread blocked on an empty queue
+    TR_DECODE,          // Decoding one transport read, destuffing included
+    TR_BCC_CHECK,       // BCC2 of one I-frame
+    TR_FREAD,
+    TR_FWRITE,
+    TR_DIGEST,
+    TR_STAGES
+}   t_trace_stage;
+
+typedef struct s_trace_event
+{
+    uint32_t    stage;
+    uint32_t    tid;
+    uint64_t    start;
+    uint64_t    end;
+}   t_trace_event;
+
+// trace.bin: this header, then count events. Ticks convert to nanoseconds
+// through ticksPerNs.
+#define TRACE_MAGIC 0x4C4C5452 // "LLTR"
+
+typedef struct s_trace_header
+{
+    uint32_t    magic;
+    uint32_t    count;
+    double      ticksPerNs;
+}   t_trace_header;
+
+extern const char *const traceStageNames[TR_STAGES];
+
+#ifdef LL_TRACE
+uint64_t    traceClock(void);
+void        traceRecord(t_trace_stage stage, uint64_t start);
+
+#define TRACE_BEGIN(stage) uint64_t traceStart_##stage = traceClock()
+#define TRACE_END(stage) traceRecord(stage, traceStart_##stage)
+#define TRACE_MARK(stage) traceRecord(stage, traceClock())
+#else
+#define TRACE_BEGIN(stage) ((void)0)
+#define TRACE_END(stage) ((void)0)
+#define TRACE_MARK(stage) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _TRANSFER_H_
+#define _TRANSFER_H_
+
+#include "mux.h"
+
+// File transfers over an open link, used by applicationLayer and by the
+// link daemon. All of them return 0 on success and -1 on error.
+
+// Called once per received file with the path it was written to.
+typedef void (*t_file_hook)(const char *path, int ok, void *arg);
+
+int sendFile(const char *filename);
+int sendFilesMux(char **names, int count, t_mux_policy policy);
+int sendBatch(char **names, int count, int coalesce, double setupTime);
+int sendTree(const char *root);
+int sendKeepalive(void);
+
+// Receives files until every file that was started has ended. The target is
+// either the output file or a directory where files keep their own names.
+int receiveFiles(const char *target);
+int receiveFilesHook(const char *target, t_file_hook hook, void *arg);
+
+#endif
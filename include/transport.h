@@ -0,0 +1,43 @@
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "link_layer.h"
+
+// Byte transports the link layer can run over. The backend is picked from
+// the "serial port" name given to llopen:
+//   /dev/ttyS10         real (or socat) serial port
+//   pty:<link>          new pseudo-terminal, its slave is symlinked at <link>
+//   unix:<path>         UNIX-domain stream socket (receiver listens, transmitter connects)
+//   udp:<local>:<peer>  UDP datagrams between two ports on 127.0.0.1
+//   socketpair:<name>   in-process UNIX socketpair, both ends open the same name
+//   mem:<name>          in-process ring buffers, both ends open the same name
+//   replay:<capture>    plays an LL_CAPTURE file back to a receiver (see capture.h)
+
+typedef struct s_transport t_transport;
+
+typedef struct s_transport_ops
+{
+    const char  *name;
+    // Wait up to timeoutMs for bytes. Returns -1 on error or when the peer
+    // closed the connection, 0 if nothing arrived, else the number of bytes read.
+    int         (*read)(t_transport *t, uint8_t *buf, size_t size, int timeoutMs);
+    // Returns -1 on error, otherwise the number of bytes written.
+    int         (*write)(t_transport *t, const uint8_t *buf, size_t size);
+    int         (*close)(t_transport *t);
+}   t_transport_ops;
+
+struct s_transport
+{
+    const t_transport_ops   *ops;
+    int                     fd;
+    int                     closed;     // Set by read when the peer went away
+    void                    *ctx;
+};
+
+t_transport *transportOpen(const char *spec, int baudRate, LinkLayerRole role);
+int         transportClose(t_transport *t);
+
+#endif
@@ -10,6 +10,10 @@ typedef struct s_statistics {
   size_t bytes_read;
   size_t n_frames;
   size_t n_errors;
+  size_t n_piggyback;
+  size_t n_rnr;
+  size_t n_aggregated;
+  size_t n_fast_retx;
   size_t total_size;
   double time_send_control;
   double time_send_data;
@@ -18,8 +22,8 @@ typedef struct s_statistics {
 
 #define TIME_DIFF(ti, tf) ((tf.tv_sec - ti.tv_sec) + (tf.tv_usec - ti.tv_usec) / 1e6)
 
-uint8_t *ultoua(size_t n);
-size_t  uatoi(uint8_t *n, uint8_t size);
+uint8_t *ultoua(uint64_t n);
+uint64_t uatoi(uint8_t *n, uint8_t size);
 int     spError(char *funcName, int isRead);
 int     err(char *funcName, char *err);
 void    info(char *funcName, char *msg);
@@ -1,36 +1,134 @@
 // Application layer protocol implementation
 
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
 #include "application_layer.h"
+#include "config.h"
+#include "delta.h"
+#include "digest.h"
+#include "link_ext.h"
 #include "link_layer.h"
+#include "log.h"
+#include "mux.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "transfer.h"
 #include "utils.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define CTRL_START 1
 #define DATA 2
 #define CTRL_END 3
+#define CTRL_KEEPALIVE 4
+#define CTRL_MANIFEST 5
+#define CTRL_PACK 6
+#define CTRL_TREE 7
+#define CTRL_TREE_END 8
+#define CTRL_RESUME 9
+#define CTRL_SIGNATURE 10
+#define HOLE 11
 
 #define TYPE_FSIZE 0
 #define TYPE_FNAME 1
-
+#define TYPE_CHANNEL 2
+#define TYPE_COUNT 3
+#define TYPE_MODE 4
+#define TYPE_RESUME 5
+#define TYPE_MTIME 6
+#define TYPE_DELTA 7
+#define TYPE_CRC32C 8
+#define TYPE_SHA256 9
+#define TYPE_STREAM 10
+
+// First byte of a data packet's payload in a delta transfer
+#define DELTA_LITERAL 0
+#define DELTA_COPY 1
+
+// Signatures per CTRL_SIGNATURE packet: type, last flag and count come first
+#define SIGS_PER_PACKET ((MAX_PAYLOAD_SIZE - 3) / 12)
+
+#define SEQ_MOD 100
+#define DATA_CHUNK (MAX_PAYLOAD_SIZE / 2)
+// Largest LL_CHUNK: a data packet has a 4 byte header
+#define DATA_CHUNK_MAX (MAX_PAYLOAD_SIZE - 4)
+
+// Receivers save the checkpoint of a resumable file every so many bytes
+#define CHECKPOINT_BYTES (16 * 1024)
+
+// Batches coalesce files up to this size into shared CTRL_PACK packets
+#define PACK_MAX_FILE DATA_CHUNK
+
+// Sizes and offsets are 64 bit on every platform
 typedef struct s_fileinfo
 {
-    size_t size;
+    uint64_t size;
     char *name;
-    size_t receivedSize;
+    char *path;
+    uint64_t receivedSize;
+    FILE *file;
+    size_t expectedNumber;
+    int mode;
+
+    int resumable;          // Keeps "<path>.ckpt" up to date while receiving
+    uint64_t mtime;
+    uint64_t checkpointed;  // Bytes covered by the last checkpoint
+
+    int delta;              // Rebuilt in "<path>.delta" from base and literal data
+    FILE *base;
+    int sparse;             // Skipped holes, so the size is set when closing
+
+    t_digest digest;        // Of every byte of the file, checked against END
+    int stream;             // Size unknown until END
 } t_file_info;
 
-int sendDataPacket(size_t dataSize, size_t sequenceNumber, uint8_t *data)
+typedef struct s_control
 {
-    if (data == NULL)
-        return -1;
+    uint8_t type;
+    uint64_t fileSize;
+    char fileName[256];
+    int channel;
+    uint64_t fileCount;
+    int mode; // Tree entries only, -1 otherwise
+    int resume;
+    uint64_t mtime;
+    int delta;
+
+    int hasCrc;
+    uint32_t crc;
+    int hasSha; // An empty SHA-256 TLV in START announces one in END
+    uint8_t sha[SHA256_SIZE];
+    int stream;
+} t_control;
+
+typedef struct s_file_list
+{
+    char *buffer;
+    char **names;
+    int count;
+} t_file_list;
+
+uint8_t *newDataPacket(size_t dataSize, size_t sequenceNumber, uint8_t *data, size_t *packetSize)
+{
+    if (data == NULL || packetSize == NULL)
+        return NULL;
 
     uint8_t *packet = malloc(dataSize + 4);
     if (packet == NULL)
-        return -1;
+        return NULL;
 
     packet[0] = DATA;
     packet[1] = sequenceNumber;
@@ -38,33 +136,47 @@ int sendDataPacket(size_t dataSize, size_t sequenceNumber, uint8_t *data)
     packet[3] = dataSize & 0xFF;
     memcpy(packet + 4, data, dataSize);
 
-    int retv = llwrite(packet, dataSize + 4);
+    *packetSize = dataSize + 4;
+    return packet;
+}
+
+int sendDataPacket(size_t dataSize, size_t sequenceNumber, uint8_t *data)
+{
+    size_t packetSize = 0;
+    uint8_t *packet = newDataPacket(dataSize, sequenceNumber, data, &packetSize);
+    if (packet == NULL)
+        return -1;
+
+    int retv = llwrite(packet, packetSize);
     return free(packet), retv;
 }
 
-int sendControlPacket(uint8_t controlField, const char *fileName, size_t fileSize)
+// Builds a START / END packet. The channel TLV is only added when channel >= 0.
+uint8_t *newControlPacket(uint8_t controlField, const char *fileName, uint64_t fileSize,
+                          int channel, size_t *packetSize)
 {
-    if (fileName == NULL)
+    if (fileName == NULL || packetSize == NULL)
     {
         printf("File name is null!\n");
-        return -1;
+        return NULL;
     }
 
     uint8_t *v1 = ultoua(fileSize);
     if (v1 == NULL)
-        return -1;
+        return NULL;
 
     uint8_t l1 = 0;
     for (; v1[l1]; l1++)
         ;
 
-    uint8_t l2 = strlen(fileName);
+    size_t nameLen = strlen(fileName);
+    uint8_t l2 = nameLen > 255 ? 255 : nameLen;
 
-    uint8_t *packet = calloc(1 + 2 + l1 + 2 + l2, sizeof(uint8_t));
+    uint8_t *packet = calloc(1 + 2 + l1 + 2 + l2 + 3, sizeof(uint8_t));
     if (packet == NULL)
     {
         printf("Packet is null!\n");
-        return free(v1), -1;
+        return free(v1), NULL;
     }
 
     size_t i = 0;
@@ -79,8 +191,85 @@ int sendControlPacket(uint8_t controlField, const char *fileName, size_t fileSiz
     memcpy(packet + i, fileName, l2);
     i += l2;
 
-    int retv = llwrite(packet, i);
-    return free(packet), free(v1), retv;
+    if (channel >= 0)
+    {
+        packet[i++] = TYPE_CHANNEL;
+        packet[i++] = 1;
+        packet[i++] = channel;
+    }
+
+    *packetSize = i;
+    return free(v1), packet;
+}
+
+static uint32_t getBE(const uint8_t *p, int bytes)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void putBE(uint8_t *p, uint64_t v, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--, v >>= 8)
+        p[i] = v & 0xFF;
+}
+
+// Adds a TLV at the end of a control packet, returns the new packet
+static uint8_t *appendTlv(uint8_t *packet, size_t *packetSize, uint8_t type,
+                          const void *value, uint8_t length)
+{
+    uint8_t *newPacket = realloc(packet, *packetSize + 2 + length);
+    if (newPacket == NULL)
+        return free(packet), NULL;
+
+    newPacket[(*packetSize)++] = type;
+    newPacket[(*packetSize)++] = length;
+    memcpy(newPacket + *packetSize, value, length);
+    *packetSize += length;
+    return newPacket;
+}
+
+static uint8_t *appendNumberTlv(uint8_t *packet, size_t *packetSize, uint8_t type, uint64_t n)
+{
+    uint8_t *value = ultoua(n);
+    if (value == NULL)
+        return free(packet), NULL;
+
+    packet = appendTlv(packet, packetSize, type, value, strlen((char *)value));
+    return free(value), packet;
+}
+
+// END packet with the digest of the whole file
+static uint8_t *newEndPacket(const char *fileName, uint64_t fileSize, int channel, t_digest *digest,
+                             size_t *packetSize)
+{
+    uint8_t *packet = newControlPacket(CTRL_END, fileName, fileSize, channel, packetSize);
+
+    uint8_t crc[4];
+    putBE(crc, digestCrc(digest), 4);
+    if (packet != NULL)
+        packet = appendTlv(packet, packetSize, TYPE_CRC32C, crc, sizeof(crc));
+
+    if (packet != NULL && digest->sha)
+    {
+        uint8_t sha[SHA256_SIZE];
+        digestSha(digest, sha);
+        packet = appendTlv(packet, packetSize, TYPE_SHA256, sha, SHA256_SIZE);
+    }
+    return packet;
+}
+
+int sendControlPacket(uint8_t controlField, const char *fileName, uint64_t fileSize)
+{
+    size_t packetSize = 0;
+    uint8_t *packet = newControlPacket(controlField, fileName, fileSize, -1, &packetSize);
+    if (packet == NULL)
+        return -1;
+
+    int retv = llwrite(packet, packetSize);
+    return free(packet), retv;
 }
 
 uint8_t *parseDataPacket(uint8_t *packet, size_t expectedSequence, size_t *retSize)
@@ -93,262 +282,1806 @@ uint8_t *parseDataPacket(uint8_t *packet, size_t expectedSequence, size_t *retSi
     if (expectedSequence != (size_t)packet[1])
         return NULL;
 
-    printf("Received packet %d\n", packet[1]);
+    if (getConfig()->telemetry == NULL)
+        logDebug(NULL, "Received packet %d", packet[1]);
 
     return packet + 4;
 }
 
-int parseControlPacket(t_file_info *fileInfo, uint8_t *packet, int *isReceiving)
+int parseControlPacket(t_control *control, uint8_t *packet, size_t packetSize)
 {
-    if (fileInfo == NULL || packet == NULL || isReceiving == NULL)
+    if (control == NULL || packet == NULL || packetSize == 0)
     {
         printf("Something is wrong with parse control packet!\n");
         return -1;
     }
 
-    size_t i = 0;
-
-    if (packet[i] != CTRL_START && packet[i] != CTRL_END)
+    if (packet[0] != CTRL_START && packet[0] != CTRL_END && packet[0] != CTRL_MANIFEST &&
+        packet[0] != CTRL_TREE && packet[0] != CTRL_TREE_END && packet[0] != CTRL_RESUME)
     {
-        printf("Control field mismatch: expected %d or %d, got %d\n", CTRL_START, CTRL_END, packet[i]);
+        printf("Control field mismatch: got %d, which is not a control packet\n", packet[0]);
         return -1;
     }
 
-    char *fileName = calloc(1000, sizeof(char));
-    if (fileName == NULL)
+    memset(control, 0, sizeof(*control));
+    control->type = packet[0];
+    control->channel = -1;
+    control->mode = -1;
+
+    int hasSize = FALSE;
+    int hasName = FALSE;
+
+    size_t i = 1;
+    while (i + 2 <= packetSize)
+    {
+        uint8_t type = packet[i++];
+        uint8_t length = packet[i++];
+        if (i + length > packetSize)
+        {
+            printf("Control packet TLV overflows the packet!\n");
+            return -1;
+        }
+
+        switch (type)
+        {
+        case TYPE_FSIZE:
+            control->fileSize = uatoi(packet + i, length);
+            hasSize = TRUE;
+            break;
+        case TYPE_FNAME:
+            memcpy(control->fileName, packet + i, length);
+            control->fileName[length] = '\0';
+            hasName = TRUE;
+            break;
+        case TYPE_CHANNEL:
+            if (length == 1)
+                control->channel = packet[i];
+            break;
+        case TYPE_COUNT:
+            control->fileCount = uatoi(packet + i, length);
+            break;
+        case TYPE_MODE:
+            control->mode = uatoi(packet + i, length);
+            break;
+        case TYPE_RESUME:
+            control->resume = TRUE;
+            break;
+        case TYPE_MTIME:
+            control->mtime = uatoi(packet + i, length);
+            break;
+        case TYPE_DELTA:
+            control->delta = TRUE;
+            break;
+        case TYPE_CRC32C:
+            control->hasCrc = length == 4;
+            control->crc = length == 4 ? getBE(packet + i, 4) : 0;
+            break;
+        case TYPE_SHA256:
+            control->hasSha = length == 0 || length == SHA256_SIZE;
+            memcpy(control->sha, packet + i, length == SHA256_SIZE ? SHA256_SIZE : 0);
+            break;
+        case TYPE_STREAM:
+            control->stream = TRUE;
+            break;
+        default:
+            break;
+        }
+
+        i += length;
+    }
+
+    // A manifest or the end of a tree carry the total size and the file count
+    if (control->type == CTRL_MANIFEST || control->type == CTRL_TREE_END)
+        hasName = TRUE;
+
+    if (!hasSize || !hasName)
     {
-        printf("Couldn't allocate memory for filename!\n");
+        printf("Control packet is missing the file size or name!\n");
         return -1;
     }
 
-    *isReceiving = packet[i++] == CTRL_START;
+    return 0;
+}
 
-    if (packet[i++] != TYPE_FSIZE)
-        return free(fileName), -1;
+// Splits a comma separated list of files, or reads one file per line from
+// "@<list file>". The names point into list->buffer.
+static int loadFileList(t_file_list *list, const char *spec)
+{
+    char sep = ',';
+    memset(list, 0, sizeof(*list));
 
-    uint8_t l1 = packet[i++];
-    uint8_t *v1 = calloc(l1, sizeof(uint8_t));
-    if (v1 == NULL)
-        return free(fileName), -1;
-    memcpy(v1, packet + i, l1);
-    i += l1;
+    if (spec[0] == '@')
+    {
+        FILE *file = fopen(spec + 1, "rb");
+        if (file == NULL)
+        {
+            printf("Couldn't open the file list '%s'!\n", spec + 1);
+            return -1;
+        }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        list->buffer = calloc(size + 1, sizeof(char));
+        if (list->buffer == NULL || fread(list->buffer, 1, size, file) != (size_t)size)
+        {
+            fclose(file);
+            return free(list->buffer), -1;
+        }
+        fclose(file);
+        sep = '\n';
+    }
+    else
+    {
+        list->buffer = strdup(spec);
+        if (list->buffer == NULL)
+            return -1;
+    }
+
+    int n = 1;
+    for (char *c = list->buffer; *c; c++)
+        n += *c == sep;
+
+    list->names = calloc(n, sizeof(char *));
+    if (list->names == NULL)
+        return free(list->buffer), -1;
+
+    char *name = list->buffer;
+    for (char *c = list->buffer;; c++)
+    {
+        if (*c != sep && *c != '\0')
+            continue;
+
+        int last = *c == '\0';
+        *c = '\0';
+        if (c > name && c[-1] == '\r')
+            c[-1] = '\0';
+        if (*name != '\0')
+            list->names[list->count++] = name;
+        if (last)
+            break;
+        name = c + 1;
+    }
 
-    size_t fileSize = uatoi(v1, l1);
+    return 0;
+}
+
+static void freeFileList(t_file_list *list)
+{
+    free(list->names);
+    free(list->buffer);
+    memset(list, 0, sizeof(*list));
+}
 
-    if (packet[i++] != TYPE_FNAME)
-        return free(fileName), free(v1), -1;
-    uint8_t l2 = packet[i++];
-    memcpy(fileName, packet + i, l2);
+static int isDirectory(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+////////////////////////////////////////////////
+// TRANSMITTER
+////////////////////////////////////////////////
+// Digests the first size bytes of file, leaving it positioned after them
+static int hashPrefix(FILE *file, uint64_t size, t_digest *digest)
+{
+    uint8_t buffer[4096];
 
-    if (packet[0] == CTRL_START)
+    if (fseeko(file, 0, SEEK_SET) < 0)
+        return -1;
+    for (uint64_t done = 0; done < size;)
     {
-        fileInfo->name = fileName;
-        fileInfo->size = fileSize;
-        fileInfo->receivedSize = 0;
-        printf("Started reception of file '%s', File Size: %ld\n", fileName, fileSize);
-        return free(v1), 0;
+        size_t n = size - done < sizeof(buffer) ? size - done : sizeof(buffer);
+        if (fread(buffer, 1, n, file) != n)
+            return -1;
+        digestUpdate(digest, buffer, n);
+        done += n;
     }
+    return 0;
+}
+
+// Waits for the receiver's answer to a resumable START
+static int64_t receiveResumeOffset(uint64_t fileSize)
+{
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    int bytes = llread(buffer);
+    if (bytes <= 0 || buffer[0] != CTRL_RESUME)
+        return -1;
+
+    t_control control;
+    if (parseControlPacket(&control, buffer, bytes) < 0 || control.fileSize > fileSize)
+        return -1;
+    return control.fileSize;
+}
 
-    if (packet[0] == CTRL_END)
+////////////////////////////////////////////////
+// DELTA
+////////////////////////////////////////////////
+// Reads the signatures the receiver sends after a delta START
+static t_delta_sig *receiveSignatures(size_t *count)
+{
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    t_delta_sig *sigs = NULL;
+    *count = 0;
+
+    int last = FALSE;
+    while (!last)
     {
-        if (fileInfo->size != fileInfo->receivedSize)
+        int bytes = llread(buffer);
+        if (bytes < 3 || buffer[0] != CTRL_SIGNATURE || 3 + buffer[2] * 12 > bytes)
+            return free(sigs), NULL;
+
+        last = buffer[1];
+        t_delta_sig *bigger = realloc(sigs, (*count + buffer[2] + 1) * sizeof(t_delta_sig));
+        if (bigger == NULL)
+            return free(sigs), NULL;
+        sigs = bigger;
+
+        for (uint8_t *p = buffer + 3; p < buffer + 3 + buffer[2] * 12; p += 12)
         {
-            printf("Size at start and size at end differ (%ld vs %ld)\n",
-                   fileInfo->size, fileInfo->receivedSize);
-            return free(fileName), free(v1), -1;
+            sigs[*count].weak = getBE(p, 4);
+            sigs[*count].strong = ((uint64_t)getBE(p + 4, 4) << 32) | getBE(p + 8, 4);
+            (*count)++;
         }
-        if (strcmp(fileInfo->name, fileName) != 0)
+    }
+
+    return sigs;
+}
+
+static int sendSignatures(FILE *base)
+{
+    t_delta_sig *sigs = NULL;
+    size_t count = 0;
+    if (base != NULL && deltaSignatures(base, &sigs, &count) < 0)
+        return -1;
+
+    uint8_t packet[MAX_PAYLOAD_SIZE];
+    size_t sent = 0;
+    do
+    {
+        size_t n = count - sent > SIGS_PER_PACKET ? SIGS_PER_PACKET : count - sent;
+        packet[0] = CTRL_SIGNATURE;
+        packet[1] = sent + n == count;
+        packet[2] = n;
+        for (size_t i = 0; i < n; i++)
         {
-            printf("Name at start and name at end differ (%s vs %s)\n",
-                   fileInfo->name, fileName);
-            return free(fileName), free(v1), -1;
+            putBE(packet + 3 + i * 12, sigs[sent + i].weak, 4);
+            putBE(packet + 7 + i * 12, sigs[sent + i].strong, 8);
         }
 
-        printf("Finished reception of file '%s'\n", fileName);
+        if (llwrite(packet, 3 + n * 12) < 0)
+            return free(sigs), -1;
+        sent += n;
+    } while (sent < count);
+
+    printf("Sent %zu block signatures of the existing copy\n", count);
+    return free(sigs), 0;
+}
+
+typedef struct s_delta_writer
+{
+    size_t sequenceNumber;
+    size_t literal;
+    size_t copied;
+} t_delta_writer;
+
+static int sendLiteral(t_delta_writer *writer, const uint8_t *data, size_t size)
+{
+    uint8_t payload[DATA_CHUNK];
+    payload[0] = DELTA_LITERAL;
+
+    for (size_t done = 0; done < size;)
+    {
+        size_t n = size - done > DATA_CHUNK - 1 ? DATA_CHUNK - 1 : size - done;
+        memcpy(payload + 1, data + done, n);
+        if (sendDataPacket(n + 1, writer->sequenceNumber, payload) < 0)
+            return -1;
+        writer->sequenceNumber = (writer->sequenceNumber + 1) % SEQ_MOD;
+        writer->literal += n;
+        done += n;
     }
+    return 0;
+}
+
+static int sendCopy(t_delta_writer *writer, size_t block, size_t count)
+{
+    uint8_t payload[7];
+    payload[0] = DELTA_COPY;
+    putBE(payload + 1, block, 4);
+    putBE(payload + 5, count, 2);
 
-    return free(fileName), free(v1), 0;
+    if (sendDataPacket(sizeof(payload), writer->sequenceNumber, payload) < 0)
+        return -1;
+    writer->sequenceNumber = (writer->sequenceNumber + 1) % SEQ_MOD;
+    writer->copied += count * DELTA_BLOCK;
+    return 0;
 }
 
-void applicationLayer(const char *serialPort, const char *role, int baudRate,
-                      int nTries, int timeout, const char *filename)
+// Sends the file as literal data and references to blocks the receiver
+// already has, found with a rolling checksum at every byte offset
+static int sendDelta(FILE *file, uint64_t fileSize, t_digest *digest)
 {
-    if (serialPort == NULL || role == NULL || filename == NULL)
+    if (fileSize > SIZE_MAX)
     {
-        printf("Error trying to initialize the application layer protocol!\n");
-        exit(-1);
+        printf("File is too big to be mapped for a delta!\n");
+        return -1;
     }
 
-    LinkLayer connectionParameters;
-    strcpy(connectionParameters.serialPort, serialPort);
-    connectionParameters.role = strcmp(role, "tx") ? LlRx : LlTx;
-    connectionParameters.baudRate = baudRate,
-    connectionParameters.nRetransmissions = nTries;
-    connectionParameters.timeout = timeout;
+    size_t count = 0;
+    t_delta_sig *sigs = receiveSignatures(&count);
+    if (sigs == NULL)
+    {
+        printf("Couldn't receive the block signatures!\n");
+        return -1;
+    }
 
-    size_t bytes = 0;
-    t_file_info fileInfo = {0, NULL, 0};
-    FILE *file = NULL;
-    uint8_t *buffer = NULL;
+    printf("Received %zu block signatures\n", count);
 
-    printf("\n");
+    uint8_t *data = NULL;
+    if (fileSize > 0)
+    {
+        data = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (data == MAP_FAILED)
+            return free(sigs), -1;
+    }
 
-    if (llopen(connectionParameters) < 0)
+    digestUpdate(digest, data, fileSize);
+
+    t_delta_index index;
+    if (deltaIndexInit(&index, sigs, count) < 0)
     {
-        printf("Error trying to start connection!\n");
-        llclose(FALSE);
-        return;
+        if (data != NULL)
+            munmap(data, fileSize);
+        return free(sigs), -1;
     }
 
-    printf("\nGeneral Connection Was Established!\nStarting data sharing!\n\n");
+    t_delta_writer writer = {0};
+    size_t pos = 0, literalStart = 0;
+    uint32_t weak = fileSize >= DELTA_BLOCK ? deltaWeak(data, DELTA_BLOCK) : 0;
+    int retv = 0;
 
-    switch (connectionParameters.role)
+    while (retv == 0 && count > 0 && pos + DELTA_BLOCK <= fileSize)
     {
-    case LlTx:
-        file = fopen(filename, "rb");
-        if (file == NULL)
+        long block = deltaIndexFind(&index, weak, data + pos);
+        if (block < 0)
         {
-            printf("Couldn't find the file!\n");
-            llclose(FALSE);
-            return;
+            if (pos + DELTA_BLOCK < fileSize)
+                weak = deltaRoll(weak, data[pos], data[pos + DELTA_BLOCK], DELTA_BLOCK);
+            pos++;
+            continue;
         }
-        fseek(file, 0, SEEK_END);
-        size_t fileSize = ftell(file);
-        fseek(file, 0, SEEK_SET);
 
-        if (sendControlPacket(CTRL_START, filename, fileSize) < 0)
+        // Runs of consecutive blocks become a single reference
+        size_t run = 1;
+        while (block + run < count && run < 0xFFFF && pos + (run + 1) * DELTA_BLOCK <= fileSize &&
+               sigs[block + run].weak == deltaWeak(data + pos + run * DELTA_BLOCK, DELTA_BLOCK) &&
+               sigs[block + run].strong == deltaStrong(data + pos + run * DELTA_BLOCK, DELTA_BLOCK))
+            run++;
+
+        retv = sendLiteral(&writer, data + literalStart, pos - literalStart);
+        if (retv == 0)
+            retv = sendCopy(&writer, block, run);
+
+        pos += run * DELTA_BLOCK;
+        literalStart = pos;
+        if (pos + DELTA_BLOCK <= fileSize)
+            weak = deltaWeak(data + pos, DELTA_BLOCK);
+    }
+
+    if (retv == 0)
+        retv = sendLiteral(&writer, data + literalStart, fileSize - literalStart);
+
+    if (retv == 0)
+        printf("Delta: %zu bytes copied from the receiver's copy, %zu literal bytes sent\n",
+               writer.copied, writer.literal);
+
+    deltaIndexFree(&index);
+    if (data != NULL)
+        munmap(data, fileSize);
+    return free(sigs), retv;
+}
+
+////////////////////////////////////////////////
+// SPARSE FILES
+////////////////////////////////////////////////
+static int isZero(const uint8_t *data, size_t size)
+{
+    return size == 0 || (data[0] == 0 && memcmp(data, data + 1, size - 1) == 0);
+}
+
+static int sendHole(size_t *sequenceNumber, uint64_t length)
+{
+    uint8_t packet[10];
+    packet[0] = HOLE;
+    packet[1] = *sequenceNumber;
+    putBE(packet + 2, length, 8);
+
+    if (llwrite(packet, sizeof(packet)) < 0)
+        return -1;
+
+    printf("Sent hole of %" PRIu64 " bytes\n", length);
+    *sequenceNumber = (*sequenceNumber + 1) % SEQ_MOD;
+    return 0;
+}
+
+// Sends the file from its current offset, replacing the holes of a sparse
+// file and every all-zero chunk with HOLE packets that only hold a length
+static int sendSparse(FILE *file, uint64_t fileSize, t_digest *digest)
+{
+    int fd = fileno(file);
+    uint64_t pos = ftello(file);
+    uint64_t dataEnd = pos;
+    uint64_t hole = 0, holeBytes = 0;
+    size_t holes = 0;
+    size_t sequenceNumber = 0;
+    uint8_t buffer[DATA_CHUNK];
+
+    while (pos < fileSize)
+    {
+        // Ask the file system where the next data is once per data region
+        if (pos >= dataEnd)
         {
-            printf("Couldn't send control packet!\n");
-            fclose(file);
-            llclose(FALSE);
-            return;
+            off_t data = lseek(fd, pos, SEEK_DATA);
+            if (data < 0)
+                data = errno == ENXIO ? (off_t)fileSize : (off_t)pos;
+            off_t end = data < (off_t)fileSize ? lseek(fd, data, SEEK_HOLE) : data;
+            dataEnd = end < 0 ? fileSize : end;
+
+            hole += data - pos;
+            digestZeros(digest, data - pos);
+            pos = data;
+            if (pos >= fileSize)
+                break;
         }
 
-        printf("Sent START control packet! \n");
+        size_t size = dataEnd - pos < DATA_CHUNK ? dataEnd - pos : DATA_CHUNK;
+        ssize_t bytes = pread(fd, buffer, size, pos);
+        if (bytes <= 0)
+            return -1;
+        pos += bytes;
 
-        bytes = 0;
-        buffer = malloc(MAX_PAYLOAD_SIZE / 2 + 20);
-        if (buffer == NULL)
+        if (isZero(buffer, bytes))
         {
-            printf("Couldn't allocate buffer memory!\n");
-            llclose(FALSE);
-            return;
+            hole += bytes;
+            digestZeros(digest, bytes);
+            continue;
         }
+        digestUpdate(digest, buffer, bytes);
+
+        if (hole > 0 && sendHole(&sequenceNumber, hole) < 0)
+            return -1;
+        holes += hole > 0;
+        holeBytes += hole;
+        hole = 0;
+
+        if (sendDataPacket(bytes, sequenceNumber, buffer) < 0)
+            return -1;
+        telemetryProgress(pos);
+        if (getConfig()->telemetry == NULL)
+            logDebug(NULL, "Sent packet %zu", sequenceNumber);
+        sequenceNumber = (sequenceNumber + 1) % SEQ_MOD;
+    }
 
-        size_t sequenceNumber = 0;
-        while ((bytes = fread(buffer, 1, MAX_PAYLOAD_SIZE / 2, file)) > 0)
-        {
-            long sendedData = sendDataPacket(bytes, sequenceNumber, buffer);
-            if (sendedData < 0)
-            {
-                printf("Error sending data packet!\n");
-                free(buffer);
-                fclose(file);
-                llclose(FALSE);
-                return;
-            }
+    if (hole > 0 && sendHole(&sequenceNumber, hole) < 0)
+        return -1;
+    holes += hole > 0;
+    holeBytes += hole;
 
-            printf("Sent packet %ld\n", sequenceNumber);
-            sequenceNumber = sequenceNumber >= 99 ? 0 : sequenceNumber + 1;
-        }
+    printf("Sparse: %" PRIu64 " bytes of holes and zero blocks sent as %zu HOLE packets\n", holeBytes, holes);
+    return 0;
+}
+
+// A stream sends whatever the producer wrote so far instead of waiting for
+// a full chunk, so a live log reaches the other side line by line
+static size_t readChunk(FILE *file, uint8_t *buffer, size_t size, int stream)
+{
+    TRACE_BEGIN(TR_FREAD);
+    ssize_t bytes;
+    if (!stream)
+        bytes = fread(buffer, 1, size, file);
+    else
+        do
+            bytes = read(fileno(file), buffer, size);
+        while (bytes < 0 && errno == EINTR);
+    TRACE_END(TR_FREAD);
+
+    return bytes < 0 ? 0 : bytes;
+}
+
+// Sends the file at path, announced under name. Tree entries also carry
+// their permission bits (mode >= 0).
+static int sendFileAs(const char *filename, const char *name, int mode)
+{
+    FILE *file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+    if (file == NULL)
+    {
+        printf("Couldn't find the file!\n");
+        return -1;
+    }
 
-        printf("All data has been sent!\n");
+    // Pipes, sockets and terminals are streamed: their size is only known
+    // once the producer closes them, so it is sent in END
+    struct stat st;
+    fstat(fileno(file), &st);
+    int stream = !S_ISREG(st.st_mode);
+
+    uint64_t fileSize = stream ? 0 : (uint64_t)st.st_size;
+
+    int delta = getConfig()->delta && !stream;
+    int resume = getConfig()->resume && !delta && !stream;
+
+    t_digest digest;
+    digestInit(&digest, getConfig()->sha256);
+
+    // A resumable START carries the modification time, which together with
+    // the name and size tells the receiver if its checkpoint is for this file
+    size_t packetSize = 0;
+    uint8_t *packet = newControlPacket(CTRL_START, name, fileSize, -1, &packetSize);
+    if (packet != NULL && mode >= 0)
+        packet = appendNumberTlv(packet, &packetSize, TYPE_MODE, mode);
+    if (packet != NULL && resume)
+        packet = appendTlv(packet, &packetSize, TYPE_RESUME, "1", 1);
+    if (packet != NULL && resume)
+        packet = appendNumberTlv(packet, &packetSize, TYPE_MTIME, st.st_mtime);
+    if (packet != NULL && delta)
+        packet = appendTlv(packet, &packetSize, TYPE_DELTA, "1", 1);
+    if (packet != NULL && digest.sha)
+        packet = appendTlv(packet, &packetSize, TYPE_SHA256, "", 0);
+    if (packet != NULL && stream)
+        packet = appendTlv(packet, &packetSize, TYPE_STREAM, "1", 1);
+
+    if (packet == NULL || llwrite(packet, packetSize) < 0)
+    {
+        printf("Couldn't send control packet!\n");
+        free(packet);
+        fclose(file);
+        return -1;
+    }
+    free(packet);
 
-        if (sendControlPacket(CTRL_END, filename, fileSize) < 0)
+    printf("Sent START control packet! \n");
+
+    uint64_t sent = 0;
+    if (resume)
+    {
+        int64_t offset = receiveResumeOffset(fileSize);
+        if (offset < 0)
         {
-            printf("Error sending end control packet!\n");
+            printf("Couldn't negotiate the resume offset!\n");
             fclose(file);
-            free(buffer);
-            llclose(FALSE);
-            return;
+            return -1;
         }
+        if (offset > 0)
+            printf("Resuming '%s' at byte %" PRId64 ", %" PRIu64 " bytes left\n", name, offset, fileSize - offset);
+        sent = offset;
+        if (hashPrefix(file, offset, &digest) < 0)
+        {
+            printf("Couldn't read the first %" PRId64 " bytes of '%s'!\n", offset, filename);
+            fclose(file);
+            return -1;
+        }
+    }
 
-        printf("Sent END control packet!\n");
-
+    size_t chunk = getConfig()->chunk > 0 && getConfig()->chunk <= DATA_CHUNK_MAX ? getConfig()->chunk : DATA_CHUNK;
+    uint8_t *buffer = malloc(chunk + 20);
+    if (buffer == NULL)
+    {
+        printf("Couldn't allocate buffer memory!\n");
         fclose(file);
+        return -1;
+    }
+    telemetryFile(name, fileSize, sent);
+
+    size_t bytes = 0;
+    size_t sequenceNumber = 0;
+    int sparse = getConfig()->sparse && !delta && !stream;
+    if ((delta && sendDelta(file, fileSize, &digest) < 0) || (sparse && sendSparse(file, fileSize, &digest) < 0))
+    {
+        printf("Error sending file data!\n");
         free(buffer);
-        break;
+        fclose(file);
+        return -1;
+    }
 
-    case LlRx:
-        file = fopen(filename, "wb");
-        if (file == NULL)
+    while (!delta && !sparse && (bytes = readChunk(file, buffer, chunk, stream)) > 0)
+    {
+        long sendedData = sendDataPacket(bytes, sequenceNumber, buffer);
+        if (sendedData < 0)
         {
-            printf("Couldn't find the file!\n");
-            llclose(FALSE);
-            return;
+            printf("Error sending data packet!\n");
+            free(buffer);
+            fclose(file);
+            return -1;
         }
 
-        buffer = malloc(MAX_PAYLOAD_SIZE / 2 + 20);
-        if (buffer == NULL)
-        {
-            printf("Couldn't allocate buffer memory!\n");
-            llclose(FALSE);
-            return;
-        }
+        TRACE_BEGIN(TR_DIGEST);
+        digestUpdate(&digest, buffer, bytes);
+        TRACE_END(TR_DIGEST);
+        fileSize += stream ? bytes : 0;
+        sent += bytes;
+        telemetryProgress(sent);
+        if (getConfig()->telemetry == NULL)
+            logDebug(NULL, "Sent packet %zu", sequenceNumber);
+        sequenceNumber = (sequenceNumber + 1) % SEQ_MOD;
+    }
 
-        bytes = 0;
-        int isReceiving = TRUE;
-        int expectedNumber = 0;
+    logFlush();
+    printf("All data has been sent!\n");
 
-        while (isReceiving)
-        {
-            bytes = llread(buffer);
-            if (bytes <= 0)
-            {
-                printf("Failed to read!\n");
-                fclose(file);
-                free(buffer);
-                llclose(FALSE);
-                return;
-            }
+    packet = newEndPacket(name, fileSize, -1, &digest, &packetSize);
+    if (packet == NULL || llwrite(packet, packetSize) < 0)
+    {
+        printf("Error sending end control packet!\n");
+        free(packet);
+        fclose(file);
+        free(buffer);
+        return -1;
+    }
 
-            if (bytes == 0)
-                continue;
+    printf("Sent END control packet!\n");
+    telemetryFileDone();
 
-            if (buffer[0] == CTRL_START || buffer[0] == CTRL_END)
-            {
-                if (parseControlPacket(&fileInfo, buffer, &isReceiving) < 0)
-                {
-                    printf("Error parsing control packet!\n");
+    free(packet);
+    fclose(file);
+    free(buffer);
+    return 0;
+}
 
-                    fclose(file);
-                    free(buffer);
-                    llclose(FALSE);
-                    return;
-                }
-            }
+// "-" streams standard input
+int sendFile(const char *filename)
+{
+    return sendFileAs(filename, strcmp(filename, "-") == 0 ? "stdin" : filename, -1);
+}
 
-            if (buffer[0] == DATA)
-            {
-                uint8_t *receivedData = parseDataPacket(buffer, expectedNumber, &bytes);
-                if (receivedData == NULL)
-                {
-                    printf("Error parsing data packet!\n");
+// Sends up to MAX_CHANNELS - 1 files at once, file i on channel i + 1.
+// START / END packets travel on the control channel, so they are never stuck
+// behind the data of another file.
+int sendFilesMux(char **names, int count, t_mux_policy policy)
+{
+    if (count >= MAX_CHANNELS)
+    {
+        printf("At most %d files can be multiplexed!\n", MAX_CHANNELS - 1);
+        return -1;
+    }
 
-                    fclose(file);
-                    free(buffer);
-                    llclose(FALSE);
-                    return;
-                }
+    t_file_info files[MAX_CHANNELS] = {0};
+    int ended[MAX_CHANNELS] = {0};
+    uint8_t buffer[DATA_CHUNK];
+    int retv = -1;
 
-                fwrite(receivedData, sizeof(uint8_t), bytes, file);
-                fileInfo.receivedSize += bytes;
+    t_mux mux;
+    muxInit(&mux, policy);
+    for (int ch = 1; ch < MAX_CHANNELS; ch++)
+        muxSetPriority(&mux, ch, getConfig()->muxPriority[ch]);
 
-                expectedNumber = expectedNumber >= 99 ? 0 : expectedNumber + 1;
-            }
+    // Every START goes out before any data, so the receiver knows all the
+    // files of the session once data starts flowing
+    for (int i = 0; i < count; i++)
+    {
+        files[i].file = fopen(names[i], "rb");
+        if (files[i].file == NULL)
+        {
+            printf("Couldn't find the file '%s'!\n", names[i]);
+            goto cleanup;
+        }
+        struct stat st;
+        fstat(fileno(files[i].file), &st);
+        files[i].size = st.st_size;
+        files[i].name = names[i];
+        digestInit(&files[i].digest, getConfig()->sha256);
+
+        size_t packetSize = 0;
+        uint8_t *packet = newControlPacket(CTRL_START, names[i], files[i].size, i + 1, &packetSize);
+        if (packet != NULL && files[i].digest.sha)
+            packet = appendTlv(packet, &packetSize, TYPE_SHA256, "", 0);
+        if (packet == NULL || llwriteChannel(CONTROL_CHANNEL, packet, packetSize) < 0)
+        {
+            printf("Couldn't send control packet!\n");
+            free(packet);
+            goto cleanup;
         }
+        free(packet);
+        printf("Sent START control packet for '%s' on channel %d\n", names[i], i + 1);
+    }
 
-        printf("All data has been received!\n");
+    int active = count;
+    while (active > 0 || muxQueued(&mux, CONTROL_CHANNEL) > 0)
+    {
+        // Keep one packet queued per channel, the scheduler interleaves them
+        for (int i = 0; i < count; i++)
+        {
+            uint8_t ch = i + 1;
+            if (ended[i] || muxQueued(&mux, ch) > 0)
+                continue;
 
-        fclose(file);
-        free(buffer);
-        free(fileInfo.name);
+            size_t bytes = fread(buffer, 1, DATA_CHUNK, files[i].file);
+            size_t packetSize = 0;
+            uint8_t *packet = NULL;
+
+            if (bytes > 0)
+            {
+                digestUpdate(&files[i].digest, buffer, bytes);
+                packet = newDataPacket(bytes, files[i].expectedNumber, buffer, &packetSize);
+                files[i].expectedNumber = (files[i].expectedNumber + 1) % SEQ_MOD;
+            }
+            else
+            {
+                packet = newEndPacket(names[i], files[i].size, ch, &files[i].digest, &packetSize);
+                ended[i] = TRUE;
+                active--;
+            }
+
+            if (packet == NULL || muxEnqueue(&mux, bytes > 0 ? ch : CONTROL_CHANNEL, packet, packetSize) < 0)
+            {
+                printf("Couldn't queue packet for channel %d!\n", ch);
+                free(packet);
+                goto cleanup;
+            }
+            free(packet);
+        }
+
+        int sent = muxSendNext(&mux);
+        if (sent < 0)
+        {
+            printf("Error sending multiplexed packet!\n");
+            goto cleanup;
+        }
+    }
+
+    logFlush();
+    printf("All files have been sent!\n");
+    retv = 0;
+
+cleanup:
+    muxFree(&mux);
+    for (int i = 0; i < count; i++)
+        if (files[i].file != NULL)
+            fclose(files[i].file);
+    return retv;
+}
+
+static int sendManifest(size_t count, uint64_t totalSize)
+{
+    uint8_t *v1 = ultoua(totalSize);
+    uint8_t *v2 = ultoua(count);
+    if (v1 == NULL || v2 == NULL)
+        return free(v1), free(v2), -1;
+
+    uint8_t l1 = strlen((char *)v1);
+    uint8_t l2 = strlen((char *)v2);
+
+    uint8_t packet[1 + 2 + 20 + 2 + 20];
+    size_t i = 0;
+    packet[i++] = CTRL_MANIFEST;
+    packet[i++] = TYPE_FSIZE;
+    packet[i++] = l1;
+    memcpy(packet + i, v1, l1);
+    i += l1;
+    packet[i++] = TYPE_COUNT;
+    packet[i++] = l2;
+    memcpy(packet + i, v2, l2);
+    i += l2;
+
+    free(v1);
+    free(v2);
+    return llwrite(packet, i) < 0 ? -1 : 0;
+}
+
+// Appends a whole file to a CTRL_PACK packet: name length, name, 16 bit size
+// and the data. Returns FALSE if it does not fit in the packet.
+static int packFile(uint8_t *packet, size_t *packetSize, const char *name, size_t size)
+{
+    size_t nameLen = strlen(name);
+    if (nameLen > 255 || *packetSize + 1 + nameLen + 2 + size > MAX_PAYLOAD_SIZE)
+        return FALSE;
+
+    FILE *file = fopen(name, "rb");
+    if (file == NULL)
+        return FALSE;
+
+    uint8_t *p = packet + *packetSize;
+    *p++ = nameLen;
+    memcpy(p, name, nameLen);
+    p += nameLen;
+    *p++ = size >> 8;
+    *p++ = size & 0xFF;
+    size_t bytes = fread(p, 1, size, file);
+    fclose(file);
+
+    if (bytes != size)
+        return FALSE;
+
+    *packetSize += 1 + nameLen + 2 + size;
+    packet[1]++;
+    return TRUE;
+}
+
+static int flushPack(uint8_t *packet, size_t *packetSize, size_t *packs)
+{
+    if (packet[1] == 0)
+        return 0;
+
+    if (llwrite(packet, *packetSize) < 0)
+    {
+        printf("Error sending packed files!\n");
+        return -1;
+    }
+
+    printf("Sent %d packed files\n", packet[1]);
+    (*packs)++;
+    packet[1] = 0;
+    *packetSize = 2;
+    return 0;
+}
+
+// Sends many files over the current connection: a manifest with the file
+// count, then every file with its own START / END, except small files that
+// are coalesced whole into shared CTRL_PACK packets when coalesce is set.
+// setupTime is what one llopen took, used to report what the batch saved.
+int sendBatch(char **names, int count, int coalesce, double setupTime)
+{
+    uint64_t *sizes = calloc(count, sizeof(uint64_t));
+    if (sizes == NULL)
+        return -1;
+
+    uint64_t totalSize = 0;
+    for (int i = 0; i < count; i++)
+    {
+        struct stat st;
+        if (stat(names[i], &st) < 0 || !S_ISREG(st.st_mode))
+        {
+            printf("Couldn't find the file '%s'!\n", names[i]);
+            return free(sizes), -1;
+        }
+        sizes[i] = st.st_size;
+        totalSize += sizes[i];
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    if (sendManifest(count, totalSize) < 0)
+    {
+        printf("Couldn't send the batch manifest!\n");
+        return free(sizes), -1;
+    }
+
+    printf("Sent manifest: %d files, %" PRIu64 " bytes\n", count, totalSize);
+
+    uint8_t packet[MAX_PAYLOAD_SIZE];
+    size_t packetSize = 2;
+    size_t packed = 0, packs = 0, frames = 1, framesPerFile = 0;
+    packet[0] = CTRL_PACK;
+    packet[1] = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t dataFrames = (sizes[i] + DATA_CHUNK - 1) / DATA_CHUNK;
+        framesPerFile += 2 + dataFrames;
+
+        if (coalesce && sizes[i] <= PACK_MAX_FILE && packet[1] < 255)
+        {
+            if (packFile(packet, &packetSize, names[i], sizes[i]))
+            {
+                packed++;
+                continue;
+            }
+            if (flushPack(packet, &packetSize, &packs) < 0)
+                return free(sizes), -1;
+            if (packFile(packet, &packetSize, names[i], sizes[i]))
+            {
+                packed++;
+                continue;
+            }
+        }
+
+        if (flushPack(packet, &packetSize, &packs) < 0 || sendFile(names[i]) < 0)
+            return free(sizes), -1;
+        frames += 2 + dataFrames;
+    }
+
+    if (flushPack(packet, &packetSize, &packs) < 0)
+        return free(sizes), -1;
+    frames += packs;
+    free(sizes);
+
+    gettimeofday(&end, NULL);
+    double elapsed = TIME_DIFF(start, end);
+
+    printf("\nBatch of %d files sent in %.3f seconds over one connection\n", count, elapsed);
+    if (coalesce)
+        printf("  - %zu small files coalesced into %zu packets\n", packed, packs);
+    printf("  - %zu I-frames instead of %zu\n", frames, framesPerFile);
+    printf("  - Setup overhead per file: %.6f seconds instead of %.6f (one handshake per file)\n",
+           setupTime / count, setupTime);
+    printf("  - Saved about %.3f seconds of handshakes\n", setupTime * (count - 1));
+    return 0;
+}
+
+typedef struct s_tree
+{
+    char path[PATH_MAX];
+    size_t skip;    // Bytes of path before the name the receiver sees
+    size_t files;
+    uint64_t bytes;
+} t_tree;
+
+static int sendTreeMarker(uint8_t controlField, const char *name, uint64_t size, size_t count)
+{
+    size_t packetSize = 0;
+    uint8_t *packet = newControlPacket(controlField, name, size, -1, &packetSize);
+    if (packet != NULL && controlField == CTRL_TREE_END)
+        packet = appendNumberTlv(packet, &packetSize, TYPE_COUNT, count);
+
+    if (packet == NULL || llwrite(packet, packetSize) < 0)
+        return free(packet), -1;
+    return free(packet), 0;
+}
+
+// Sends the directory at tree->path and everything below it, depth first.
+// Directories are announced by a START with a directory mode and no END.
+static int sendTreeDir(t_tree *tree, const struct stat *st)
+{
+    size_t pathLen = strlen(tree->path);
+    const char *name = tree->path + tree->skip;
+
+    size_t packetSize = 0;
+    uint8_t *packet = newControlPacket(CTRL_START, name, 0, -1, &packetSize);
+    if (packet != NULL)
+        packet = appendNumberTlv(packet, &packetSize, TYPE_MODE, st->st_mode & (S_IFMT | 07777));
+    if (packet == NULL || llwrite(packet, packetSize) < 0)
+    {
+        printf("Couldn't send directory '%s'!\n", name);
+        return free(packet), -1;
+    }
+    free(packet);
+    printf("Sent directory '%s'\n", name);
+
+    DIR *dir = opendir(tree->path);
+    if (dir == NULL)
+    {
+        printf("Couldn't open directory '%s'!\n", tree->path);
+        return -1;
+    }
+
+    int retv = 0;
+    struct dirent *entry;
+    while (retv == 0 && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        if (pathLen + 1 + strlen(entry->d_name) >= sizeof(tree->path) ||
+            pathLen + 1 + strlen(entry->d_name) - tree->skip > 255)
+        {
+            printf("Path too long, skipping '%s/%s'\n", tree->path, entry->d_name);
+            continue;
+        }
+        sprintf(tree->path + pathLen, "/%s", entry->d_name);
+
+        struct stat entryStat;
+        if (lstat(tree->path, &entryStat) < 0)
+            printf("Couldn't stat '%s', skipping it\n", tree->path);
+        else if (S_ISDIR(entryStat.st_mode))
+            retv = sendTreeDir(tree, &entryStat);
+        else if (S_ISREG(entryStat.st_mode))
+        {
+            retv = sendFileAs(tree->path, tree->path + tree->skip, entryStat.st_mode & 07777);
+            tree->files++;
+            tree->bytes += entryStat.st_size;
+        }
+        else
+            printf("Skipping '%s', not a regular file or directory\n", tree->path);
+
+        tree->path[pathLen] = '\0';
+    }
+
+    closedir(dir);
+    return retv;
+}
+
+// Streams a whole directory tree: entries are read and sent as the walk
+// reaches them, so nothing is packed or counted beforehand. The receiver
+// recreates the tree below its target directory.
+int sendTree(const char *root)
+{
+    t_tree *tree = calloc(1, sizeof(t_tree));
+    if (tree == NULL)
+        return -1;
+
+    snprintf(tree->path, sizeof(tree->path), "%s", root);
+    size_t len = strlen(tree->path);
+    while (len > 1 && tree->path[len - 1] == '/')
+        tree->path[--len] = '\0';
+
+    char *slash = strrchr(tree->path, '/');
+    tree->skip = slash != NULL ? (size_t)(slash - tree->path) + 1 : 0;
+
+    const char *name = tree->path + tree->skip;
+    struct stat st;
+    if (stat(tree->path, &st) < 0 || !S_ISDIR(st.st_mode) || *name == '\0' ||
+        strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    {
+        printf("'%s' is not a directory that can be sent!\n", root);
+        return free(tree), -1;
+    }
+
+    if (sendTreeMarker(CTRL_TREE, tree->path + tree->skip, 0, 0) < 0 || sendTreeDir(tree, &st) < 0 ||
+        sendTreeMarker(CTRL_TREE_END, tree->path + tree->skip, tree->bytes, tree->files) < 0)
+    {
+        printf("Error sending directory tree '%s'!\n", root);
+        return free(tree), -1;
+    }
+
+    printf("Sent directory tree '%s': %zu files, %" PRIu64 " bytes\n", root, tree->files, tree->bytes);
+    return free(tree), 0;
+}
+
+// Keeps an idle link alive, the receiver ignores it. It must not wait for
+// other packets to share its frame.
+int sendKeepalive(void)
+{
+    uint8_t packet = CTRL_KEEPALIVE;
+    return llwrite(&packet, 1) < 0 || llflush() < 0 ? -1 : 0;
+}
+
+////////////////////////////////////////////////
+// RECEIVER
+////////////////////////////////////////////////
+// Tree entries must stay below the target directory
+static int isSafeTreePath(const char *name)
+{
+    if (name[0] == '\0' || name[0] == '/')
+        return FALSE;
+
+    for (const char *c = name; *c;)
+    {
+        size_t len = strcspn(c, "/");
+        if (len == 0 || (len == 1 && c[0] == '.') || (len == 2 && c[0] == '.' && c[1] == '.'))
+            return FALSE;
+        c += len;
+        c += *c == '/';
+    }
+    return TRUE;
+}
+
+// Creates the missing directories of path, the last component excluded
+static int makeParents(char *path)
+{
+    for (char *c = strchr(path + 1, '/'); c != NULL; c = strchr(c + 1, '/'))
+    {
+        *c = '\0';
+        int retv = mkdir(path, 0755);
+        *c = '/';
+        if (retv < 0 && errno != EEXIST)
+        {
+            printf("Couldn't create directory for '%s'!\n", path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int treePath(char *path, size_t size, const char *target, const t_control *control)
+{
+    if (!isDirectory(target) || !isSafeTreePath(control->fileName))
+    {
+        printf("Refusing tree entry '%s', it needs a directory as output and a relative path!\n",
+               control->fileName);
+        return -1;
+    }
+
+    snprintf(path, size, "%s/%s", target, control->fileName);
+    return makeParents(path);
+}
+
+static int makeTreeDir(const char *target, const t_control *control)
+{
+    char path[PATH_MAX];
+    if (treePath(path, sizeof(path), target, control) < 0)
+        return -1;
+
+    if (mkdir(path, 0700) < 0 && errno != EEXIST)
+    {
+        printf("Couldn't create directory '%s'!\n", path);
+        return -1;
+    }
+
+    // Keep the directory writable until its files are in
+    chmod(path, (control->mode & 07777) | 0700);
+    printf("Created directory '%s'\n", path);
+    return 0;
+}
+
+////////////////////////////////////////////////
+// CHECKPOINTS
+////////////////////////////////////////////////
+// A resumable file being received has a "<path>.ckpt" next to it with the
+// identity of the file and how many bytes of it were received and written.
+static int saveCheckpoint(t_file_info *fileInfo)
+{
+    char path[PATH_MAX + 16], tmp[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s.ckpt", fileInfo->path);
+    snprintf(tmp, sizeof(tmp), "%s.ckpt.tmp", fileInfo->path);
+
+    if (fflush(fileInfo->file) != 0)
+        return -1;
+
+    FILE *file = fopen(tmp, "w");
+    if (file == NULL)
+        return -1;
+
+    fprintf(file, "resume-v1 %" PRIu64 " %" PRIu64 " %" PRIu64 "\n%s\n", fileInfo->size, fileInfo->mtime,
+            fileInfo->receivedSize, fileInfo->name);
+    if (fclose(file) != 0 || rename(tmp, path) < 0)
+        return unlink(tmp), -1;
+
+    fileInfo->checkpointed = fileInfo->receivedSize;
+    return 0;
+}
+
+// Returns how many bytes of the output at path can be kept, 0 when there is
+// no checkpoint or it belongs to another file
+static uint64_t loadCheckpoint(const char *path, const t_control *control)
+{
+    char ckpt[PATH_MAX + 16];
+    snprintf(ckpt, sizeof(ckpt), "%s.ckpt", path);
+
+    FILE *file = fopen(ckpt, "r");
+    if (file == NULL)
+        return 0;
+
+    uint64_t size = 0, mtime = 0, offset = 0;
+    char name[256] = {0};
+    int fields = fscanf(file, "resume-v1 %" SCNu64 " %" SCNu64 " %" SCNu64 "\n%255[^\n]", &size, &mtime, &offset, name);
+    fclose(file);
+
+    struct stat st;
+    if (fields != 4 || size != control->fileSize || mtime != control->mtime || offset > size ||
+        strcmp(name, control->fileName) != 0 || stat(path, &st) < 0 || (uint64_t)st.st_size < offset)
+    {
+        printf("Checkpoint '%s' does not match, starting from byte 0\n", ckpt);
+        return 0;
+    }
+
+    return offset;
+}
+
+static void removeCheckpoint(const t_file_info *fileInfo)
+{
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s.ckpt", fileInfo->path);
+    unlink(path);
+}
+
+static int sendResumeOffset(const char *name, uint64_t offset)
+{
+    size_t packetSize = 0;
+    uint8_t *packet = newControlPacket(CTRL_RESUME, name, offset, -1, &packetSize);
+    if (packet == NULL || llwrite(packet, packetSize) < 0)
+        return free(packet), -1;
+    return free(packet), 0;
+}
+
+static int openOutput(t_file_info *fileInfo, const char *target, const t_control *control, int nFiles)
+{
+    char path[PATH_MAX];
+
+    if (control->mode >= 0)
+    {
+        if (treePath(path, sizeof(path), target, control) < 0)
+            return -1;
+    }
+    else if (isDirectory(target))
+    {
+        char name[256];
+        strcpy(name, control->fileName);
+        snprintf(path, sizeof(path), "%s/%s", target, basename(name));
+    }
+    else if (nFiles > 0)
+    {
+        printf("Receiving several files requires a directory as output!\n");
+        return -1;
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "%s", target);
+    }
+
+    int resume = control->resume && !control->delta;
+    uint64_t offset = resume ? loadCheckpoint(path, control) : 0;
+
+    // A delta is rebuilt next to the existing copy, which it replaces at the end
+    char outputPath[PATH_MAX + 16];
+    snprintf(outputPath, sizeof(outputPath), control->delta ? "%s.delta" : "%s", path);
+    if (control->delta)
+        fileInfo->base = fopen(path, "rb");
+
+    fileInfo->file = fopen(outputPath, offset > 0 ? "r+b" : "wb");
+    if (fileInfo->file == NULL)
+    {
+        printf("Couldn't open '%s'!\n", outputPath);
+        return -1;
+    }
+
+    // Whatever came after the last checkpoint is sent again
+    if (offset > 0 && (ftruncate(fileno(fileInfo->file), offset) < 0 || fseeko(fileInfo->file, offset, SEEK_SET) < 0))
+    {
+        printf("Couldn't resume '%s'!\n", path);
+        fclose(fileInfo->file);
+        fileInfo->file = NULL;
+        return -1;
+    }
+
+    fileInfo->name = strdup(control->fileName);
+    fileInfo->path = strdup(path);
+    fileInfo->size = control->fileSize;
+    fileInfo->receivedSize = offset;
+    fileInfo->expectedNumber = 0;
+    fileInfo->mode = control->mode;
+    fileInfo->resumable = resume;
+    fileInfo->mtime = control->mtime;
+    fileInfo->delta = control->delta;
+    fileInfo->stream = control->stream;
+    digestInit(&fileInfo->digest, control->hasSha);
+
+    // The bytes kept from an earlier attempt count for the digest too. The
+    // stream switches from reading to writing, which needs a seek in between.
+    if (offset > 0 && (hashPrefix(fileInfo->file, offset, &fileInfo->digest) < 0 ||
+                       fseeko(fileInfo->file, offset, SEEK_SET) < 0))
+    {
+        printf("Couldn't read back '%s'!\n", path);
+        return -1;
+    }
+
+    if (fileInfo->stream)
+        printf("Started reception of stream '%s', size unknown\n", fileInfo->name);
+    else
+        printf("Started reception of file '%s', File Size: %" PRIu64 "\n", fileInfo->name, fileInfo->size);
+    telemetryFile(fileInfo->name, fileInfo->stream ? 0 : fileInfo->size, offset);
+
+    if (control->delta && sendSignatures(fileInfo->base) < 0)
+    {
+        printf("Couldn't send the block signatures!\n");
+        return -1;
+    }
+
+    if (resume)
+    {
+        if (offset > 0)
+            printf("Resuming at byte %" PRIu64 "\n", offset);
+        if (saveCheckpoint(fileInfo) < 0 || sendResumeOffset(fileInfo->name, offset) < 0)
+        {
+            printf("Couldn't answer the resume request!\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Appends the payload of a data packet to the output. Delta payloads are
+// either literal bytes or a run of blocks copied from the existing copy.
+static int writeData(t_file_info *fileInfo, const uint8_t *data, size_t size)
+{
+    if (!fileInfo->delta)
+    {
+        TRACE_BEGIN(TR_FWRITE);
+        fwrite(data, sizeof(uint8_t), size, fileInfo->file);
+        TRACE_END(TR_FWRITE);
+        TRACE_BEGIN(TR_DIGEST);
+        digestUpdate(&fileInfo->digest, data, size);
+        TRACE_END(TR_DIGEST);
+        fileInfo->receivedSize += size;
+
+        // Someone may be following a stream's output as it grows
+        if (fileInfo->stream)
+            fflush(fileInfo->file);
+        return 0;
+    }
+
+    if (size >= 1 && data[0] == DELTA_LITERAL)
+    {
+        fwrite(data + 1, sizeof(uint8_t), size - 1, fileInfo->file);
+        digestUpdate(&fileInfo->digest, data + 1, size - 1);
+        fileInfo->receivedSize += size - 1;
+        return 0;
+    }
+
+    if (size != 7 || data[0] != DELTA_COPY || fileInfo->base == NULL)
+    {
+        printf("Invalid delta packet!\n");
+        return -1;
+    }
+
+    size_t block = getBE(data + 1, 4);
+    size_t count = getBE(data + 5, 2);
+    uint8_t buffer[DELTA_BLOCK];
+
+    if (fseeko(fileInfo->base, (off_t)block * DELTA_BLOCK, SEEK_SET) < 0)
+        return -1;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (fread(buffer, 1, DELTA_BLOCK, fileInfo->base) != DELTA_BLOCK)
+        {
+            printf("Delta refers to block %zu, past the end of the existing copy!\n", block + i);
+            return -1;
+        }
+        fwrite(buffer, sizeof(uint8_t), DELTA_BLOCK, fileInfo->file);
+        digestUpdate(&fileInfo->digest, buffer, DELTA_BLOCK);
+    }
+    fileInfo->receivedSize += count * DELTA_BLOCK;
+    return 0;
+}
+
+// The rebuilt file replaces the old copy only when it is complete
+static void finishDelta(t_file_info *fileInfo, int ok)
+{
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s.delta", fileInfo->path);
+
+    if (fileInfo->base != NULL)
+        fclose(fileInfo->base);
+    fileInfo->base = NULL;
+
+    if (!ok || rename(path, fileInfo->path) < 0)
+        unlink(path);
+}
+
+static int digestMatches(t_file_info *fileInfo, const t_control *control)
+{
+    if (control->hasCrc && control->crc != digestCrc(&fileInfo->digest))
+        return FALSE;
+
+    if (control->hasSha && fileInfo->digest.sha)
+    {
+        uint8_t sha[SHA256_SIZE];
+        digestSha(&fileInfo->digest, sha);
+        if (memcmp(sha, control->sha, SHA256_SIZE) != 0)
+            return FALSE;
+        printf("SHA-256 of '%s' verified\n", fileInfo->name);
+    }
+    return TRUE;
+}
+
+static int closeOutput(t_file_info *fileInfo, const t_control *control, t_file_hook hook, void *arg)
+{
+    int retv = 0;
+    int corrupt = FALSE;
+
+    if (fileInfo->file == NULL)
+    {
+        printf("Got END for a file that was never started!\n");
+        return -1;
+    }
+
+    if (fileInfo->stream)
+        fileInfo->size = control->fileSize;
+
+    if (fileInfo->size != fileInfo->receivedSize || control->fileSize != fileInfo->size)
+    {
+        printf("Size at start and size at end differ (%" PRIu64 " vs %" PRIu64 ")\n",
+               fileInfo->size, fileInfo->receivedSize);
+        retv = -1;
+    }
+    else if (strcmp(fileInfo->name, control->fileName) != 0)
+    {
+        printf("Name at start and name at end differ (%s vs %s)\n",
+               fileInfo->name, control->fileName);
+        retv = -1;
+    }
+    else if (!digestMatches(fileInfo, control))
+    {
+        printf("File digest mismatch, '%s' is corrupted!\n", fileInfo->name);
+        retv = -1;
+        corrupt = TRUE;
+    }
+    else
+    {
+        logFlush();
+        printf("Finished reception of file '%s'\n", fileInfo->name);
+    }
+
+    // A corrupted file can't be resumed, the next attempt starts over
+    if (fileInfo->resumable && (retv == 0 || corrupt))
+        removeCheckpoint(fileInfo);
+    else if (fileInfo->resumable)
+        saveCheckpoint(fileInfo);
+
+    // A trailing hole was only skipped over, give the file its full size
+    if (fileInfo->sparse && fflush(fileInfo->file) == 0)
+        ftruncate(fileno(fileInfo->file), fileInfo->receivedSize);
+
+    fclose(fileInfo->file);
+    if (fileInfo->delta)
+        finishDelta(fileInfo, retv == 0);
+    if (fileInfo->mode >= 0)
+        chmod(fileInfo->path, fileInfo->mode & 07777);
+    if (hook != NULL)
+        hook(fileInfo->path, retv == 0, arg);
+
+    free(fileInfo->name);
+    free(fileInfo->path);
+    memset(fileInfo, 0, sizeof(*fileInfo));
+    return retv;
+}
+
+int receiveFiles(const char *target)
+{
+    return receiveFilesHook(target, NULL, NULL);
+}
+
+// Writes every file of a CTRL_PACK packet. Returns how many files it held.
+static int receivePack(uint8_t *packet, size_t packetSize, const char *target, int nFiles,
+                       t_file_hook hook, void *arg)
+{
+    size_t i = 2;
+    for (int n = 0; n < packet[1]; n++)
+    {
+        t_file_info fileInfo = {0};
+        t_control control = {.type = CTRL_END, .channel = -1, .mode = -1};
+
+        if (i + 1 > packetSize || i + 1 + packet[i] + 2 > packetSize)
+        {
+            printf("Packed file overflows the packet!\n");
+            return -1;
+        }
+
+        uint8_t nameLen = packet[i++];
+        memcpy(control.fileName, packet + i, nameLen);
+        control.fileName[nameLen] = '\0';
+        i += nameLen;
+        control.fileSize = (packet[i] << 8) + packet[i + 1];
+        i += 2;
+
+        if (i + control.fileSize > packetSize)
+        {
+            printf("Packed file overflows the packet!\n");
+            return -1;
+        }
+
+        if (openOutput(&fileInfo, target, &control, nFiles + n) < 0)
+            return -1;
+        fwrite(packet + i, sizeof(uint8_t), control.fileSize, fileInfo.file);
+        fileInfo.receivedSize = control.fileSize;
+        i += control.fileSize;
+
+        if (closeOutput(&fileInfo, &control, hook, arg) < 0)
+            return -1;
+    }
+
+    return packet[1];
+}
+
+int receiveFilesHook(const char *target, t_file_hook hook, void *arg)
+{
+    t_file_info files[MAX_CHANNELS] = {0};
+    int nFiles = 0;
+    int active = 0;
+    int retv = -1;
+
+    // Set by a batch manifest: files still to come after the active ones end
+    size_t expected = 0;
+    // Inside a directory tree, which only ends with CTRL_TREE_END
+    int tree = FALSE;
+    size_t treeFiles = 0;
+
+    uint8_t *buffer = malloc(MAX_PAYLOAD_SIZE + 20);
+    if (buffer == NULL)
+    {
+        printf("Couldn't allocate buffer memory!\n");
+        return -1;
+    }
+
+    int isReceiving = TRUE;
+    while (isReceiving)
+    {
+        uint8_t channel = 0;
+        int bytes = llreadChannel(buffer, &channel);
+        if (bytes <= 0)
+        {
+            printf("Failed to read!\n");
+            goto cleanup;
+        }
+
+        if (buffer[0] == CTRL_PACK)
+        {
+            int count = receivePack(buffer, bytes, target, nFiles, hook, arg);
+            if (count < 0)
+                goto cleanup;
+            nFiles += count;
+            expected = expected > (size_t)count ? expected - count : 0;
+            isReceiving = active > 0 || expected > 0 || tree;
+        }
+
+        if (buffer[0] == CTRL_START || buffer[0] == CTRL_END || buffer[0] == CTRL_MANIFEST ||
+            buffer[0] == CTRL_TREE || buffer[0] == CTRL_TREE_END)
+        {
+            t_control control;
+            if (parseControlPacket(&control, buffer, bytes) < 0)
+            {
+                printf("Error parsing control packet!\n");
+                goto cleanup;
+            }
+
+            if (control.type == CTRL_MANIFEST)
+            {
+                if (control.fileCount > 1 && !isDirectory(target))
+                {
+                    printf("Receiving several files requires a directory as output!\n");
+                    goto cleanup;
+                }
+                printf("Receiving a batch of %" PRIu64 " files, %" PRIu64 " bytes\n", control.fileCount, control.fileSize);
+                expected = control.fileCount;
+                isReceiving = expected > 0;
+                continue;
+            }
+
+            if (control.type == CTRL_TREE)
+            {
+                if (!isDirectory(target))
+                {
+                    printf("Receiving a directory tree requires a directory as output!\n");
+                    goto cleanup;
+                }
+                printf("Receiving directory tree '%s'\n", control.fileName);
+                tree = TRUE;
+                treeFiles = 0;
+                continue;
+            }
+
+            if (control.type == CTRL_TREE_END)
+            {
+                if (control.fileCount != treeFiles)
+                {
+                    printf("Directory tree had %" PRIu64 " files, received %zu\n", control.fileCount, treeFiles);
+                    goto cleanup;
+                }
+                printf("Received directory tree: %" PRIu64 " files, %" PRIu64 " bytes\n", control.fileCount, control.fileSize);
+                tree = FALSE;
+                isReceiving = active > 0 || expected > 0;
+                continue;
+            }
+
+            if (control.type == CTRL_START && control.mode >= 0 && S_ISDIR(control.mode))
+            {
+                if (makeTreeDir(target, &control) < 0)
+                    goto cleanup;
+                continue;
+            }
+
+            int ch = control.channel >= 0 ? control.channel : channel;
+            if (ch >= MAX_CHANNELS)
+            {
+                printf("Control packet refers to invalid channel %d!\n", ch);
+                goto cleanup;
+            }
+
+            if (control.type == CTRL_START)
+            {
+                if (files[ch].file != NULL)
+                {
+                    printf("Channel %d is already receiving a file!\n", ch);
+                    goto cleanup;
+                }
+                if (openOutput(&files[ch], target, &control, nFiles) < 0)
+                    goto cleanup;
+                nFiles++;
+                active++;
+                expected = expected > 0 ? expected - 1 : 0;
+            }
+            else
+            {
+                if (closeOutput(&files[ch], &control, hook, arg) < 0)
+                {
+                    printf("Error parsing control packet!\n");
+                    goto cleanup;
+                }
+                active--;
+                treeFiles += tree;
+                telemetryFileDone();
+                isReceiving = active > 0 || expected > 0 || tree;
+            }
+        }
+
+        if (buffer[0] == DATA)
+        {
+            t_file_info *fileInfo = &files[channel];
+            size_t dataSize = 0;
+            uint8_t *receivedData = parseDataPacket(buffer, fileInfo->expectedNumber, &dataSize);
+            if (receivedData == NULL || fileInfo->file == NULL)
+            {
+                printf("Error parsing data packet!\n");
+                goto cleanup;
+            }
+
+            if (writeData(fileInfo, receivedData, dataSize) < 0)
+                goto cleanup;
+            telemetryProgress(fileInfo->receivedSize);
+
+            if (fileInfo->resumable && fileInfo->receivedSize - fileInfo->checkpointed >= CHECKPOINT_BYTES)
+                saveCheckpoint(fileInfo);
+
+            fileInfo->expectedNumber = (fileInfo->expectedNumber + 1) % SEQ_MOD;
+        }
+
+        // Holes are skipped over, the file system leaves them unallocated
+        if (buffer[0] == HOLE)
+        {
+            t_file_info *fileInfo = &files[channel];
+            if (bytes != 10 || buffer[1] != fileInfo->expectedNumber || fileInfo->file == NULL ||
+                fileInfo->delta)
+            {
+                printf("Error parsing hole packet!\n");
+                goto cleanup;
+            }
+
+            uint64_t length = ((uint64_t)getBE(buffer + 2, 4) << 32) | getBE(buffer + 6, 4);
+            if (fseeko(fileInfo->file, length, SEEK_CUR) < 0)
+            {
+                printf("Couldn't skip a hole of %" PRIu64 " bytes!\n", length);
+                goto cleanup;
+            }
+
+            digestZeros(&fileInfo->digest, length);
+            logDebug(NULL, "Received hole of %" PRIu64 " bytes", length);
+            fileInfo->receivedSize += length;
+            fileInfo->sparse = TRUE;
+            telemetryProgress(fileInfo->receivedSize);
+            fileInfo->expectedNumber = (fileInfo->expectedNumber + 1) % SEQ_MOD;
+        }
+    }
+
+    logFlush();
+    printf("All data has been received!\n");
+    retv = 0;
+
+cleanup:
+    for (int i = 0; i < MAX_CHANNELS; i++)
+    {
+        if (files[i].file != NULL && files[i].resumable)
+            saveCheckpoint(&files[i]);
+        if (files[i].file != NULL)
+            fclose(files[i].file);
+        if (files[i].file != NULL && files[i].delta)
+            finishDelta(&files[i], FALSE);
+        free(files[i].name);
+        free(files[i].path);
+    }
+    free(buffer);
+    return retv;
+}
+
+////////////////////////////////////////////////
+// DUPLEX
+////////////////////////////////////////////////
+typedef struct s_duplex
+{
+    t_link *link;
+    const char *path;
+    LinkLayerRole direction;
+    int retv;
+} t_duplex;
+
+// Runs the opposite direction of a duplex session on the same link
+static void *duplexLoop(void *arg)
+{
+    t_duplex *duplex = arg;
+
+    lluse(duplex->link);
+    duplex->retv = duplex->direction == LlTx ? sendFile(duplex->path) : receiveFiles(duplex->path);
+    return NULL;
+}
+
+void applicationLayer(const char *serialPort, const char *role, int baudRate,
+                      int nTries, int timeout, const char *filename)
+{
+    if (serialPort == NULL || role == NULL || filename == NULL)
+    {
+        printf("Error trying to initialize the application layer protocol!\n");
+        exit(-1);
+    }
+
+    const t_config *config = getConfig();
+
+    LinkLayer connectionParameters;
+    strcpy(connectionParameters.serialPort, serialPort);
+    connectionParameters.role = strcmp(role, "tx") ? LlRx : LlTx;
+    connectionParameters.baudRate = baudRate,
+    connectionParameters.nRetransmissions = nTries;
+    connectionParameters.timeout = timeout;
+
+    printf("\n");
+
+    struct timeval openStart, openEnd;
+    gettimeofday(&openStart, NULL);
+
+    if (llopen(connectionParameters) < 0)
+    {
+        logFlush();
+        printf("Error trying to start connection!\n");
+        llclose(FALSE);
+        return;
+    }
+
+    gettimeofday(&openEnd, NULL);
+
+    printf("\nGeneral Connection Was Established!\nStarting data sharing!\n\n");
+
+    int retv = 0;
+
+    // Both ends send at once: the second direction gets its own thread
+    t_duplex duplex = {llcurrent(), NULL, LlTx, 0};
+    pthread_t duplexThread;
+
+    if (connectionParameters.role == LlTx)
+        duplex.path = config->duplexRecv, duplex.direction = LlRx;
+    else
+        duplex.path = config->duplexSend, duplex.direction = LlTx;
+
+    if (duplex.path != NULL && pthread_create(&duplexThread, NULL, duplexLoop, &duplex) != 0)
+    {
+        printf("Couldn't start the duplex thread!\n");
+        llclose(FALSE);
+        return;
+    }
+
+    switch (connectionParameters.role)
+    {
+    case LlTx:
+        if (isDirectory(filename))
+        {
+            retv = sendTree(filename);
+        }
+        else if (config->batch)
+        {
+            t_file_list list;
+            if (loadFileList(&list, filename) < 0)
+            {
+                printf("Couldn't parse the file list!\n");
+                retv = -1;
+                break;
+            }
+            retv = sendBatch(list.names, list.count, config->coalesce, TIME_DIFF(openStart, openEnd));
+            freeFileList(&list);
+        }
+        else if (config->mux)
+        {
+            t_file_list list;
+            if (loadFileList(&list, filename) < 0)
+            {
+                printf("Couldn't parse the file list!\n");
+                retv = -1;
+                break;
+            }
+            retv = sendFilesMux(list.names, list.count, config->muxPolicy);
+            freeFileList(&list);
+        }
+        else
+        {
+            retv = sendFile(filename);
+        }
+        break;
+
+    case LlRx:
+        retv = receiveFiles(filename);
         break;
 
     default:
         break;
     }
 
+    if (duplex.path != NULL)
+    {
+        pthread_join(duplexThread, NULL);
+        retv = retv < 0 ? retv : duplex.retv;
+    }
+
+    if (retv < 0)
+    {
+        llclose(FALSE);
+        return;
+    }
+
     printf("\n");
 
     if (llclose(TRUE) < 0)
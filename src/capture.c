@@ -0,0 +1,153 @@
+// Raw line capture, see capture.h
+
+#include "capture.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define CAPTURE_BUFFER (256 * 1024)
+
+struct s_capture
+{
+    FILE        *file;
+    char        *buffer;
+    uint64_t    last;       // Microseconds, of the last record
+    int         failed;
+};
+
+static uint64_t nowUs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+////////////////////////////////////////////////
+// WRITER
+////////////////////////////////////////////////
+t_capture *captureOpen(const char *path, LinkLayerRole role, int baudRate)
+{
+    // One file per link, in the order they open
+    static int opened = 0;
+    static pthread_mutex_t openLock = PTHREAD_MUTEX_INITIALIZER;
+    char name[512];
+    pthread_mutex_lock(&openLock);
+    int n = ++opened;
+    pthread_mutex_unlock(&openLock);
+    if (n == 1)
+        snprintf(name, sizeof(name), "%s", path);
+    else
+        snprintf(name, sizeof(name), "%s.%d", path, n);
+
+    t_capture *c = calloc(1, sizeof(t_capture));
+    if (c == NULL)
+        return NULL;
+
+    c->file = fopen(name, "wb");
+    if (c->file == NULL)
+    {
+        printf("Couldn't create the capture '%s'!\n", name);
+        return free(c), NULL;
+    }
+    c->buffer = malloc(CAPTURE_BUFFER);
+    if (c->buffer != NULL)
+        setvbuf(c->file, c->buffer, _IOFBF, CAPTURE_BUFFER);
+
+    struct timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    t_capture_header header = {.magic = CAPTURE_MAGIC, .version = CAPTURE_VERSION, .role = role,
+                               .baudRate = baudRate, .start = real.tv_sec + real.tv_nsec / 1e9};
+    c->last = nowUs();
+    if (fwrite(&header, sizeof(header), 1, c->file) != 1)
+        c->failed = 1;
+
+    printf("Capturing the line to '%s'\n", name);
+    return c;
+}
+
+void captureBytes(t_capture *c, t_capture_dir dir, const uint8_t *bytes, size_t size)
+{
+    if (c == NULL || size == 0)
+        return;
+
+    // The stream lock keeps each record whole and the timestamps in order
+    flockfile(c->file);
+    for (size_t done = 0; done < size && !c->failed;)
+    {
+        size_t n = size - done < CAPTURE_RECORD_MAX ? size - done : CAPTURE_RECORD_MAX;
+        uint64_t now = nowUs();
+        uint64_t delta = now - c->last;
+        uint32_t time = delta > UINT32_MAX ? UINT32_MAX : delta;
+        uint16_t info = n | (dir == CAPTURE_WRITE ? CAPTURE_WRITTEN : 0);
+        c->last = now;
+
+        if (fwrite(&time, sizeof(time), 1, c->file) != 1 ||
+            fwrite(&info, sizeof(info), 1, c->file) != 1 ||
+            fwrite(bytes + done, 1, n, c->file) != n)
+            c->failed = 1;
+        done += n;
+    }
+    funlockfile(c->file);
+}
+
+int captureClose(t_capture *c)
+{
+    if (c == NULL)
+        return 0;
+
+    int retv = fclose(c->file) == 0 && !c->failed ? 0 : -1;
+    if (retv < 0)
+        printf("The capture is incomplete!\n");
+    free(c->buffer);
+    free(c);
+    return retv;
+}
+
+////////////////////////////////////////////////
+// READER
+////////////////////////////////////////////////
+int captureReaderOpen(t_capture_reader *r, const char *path)
+{
+    memset(r, 0, sizeof(*r));
+    r->file = fopen(path, "rb");
+    if (r->file == NULL)
+        return -1;
+
+    if (fread(&r->header, sizeof(r->header), 1, r->file) != 1 || r->header.magic != CAPTURE_MAGIC ||
+        r->header.version != CAPTURE_VERSION)
+    {
+        fclose(r->file);
+        r->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int captureNext(t_capture_reader *r, t_capture_record *record)
+{
+    uint32_t time;
+    uint16_t info;
+    if (fread(&time, sizeof(time), 1, r->file) != 1)
+        return feof(r->file) ? 0 : -1;
+    if (fread(&info, sizeof(info), 1, r->file) != 1)
+        return -1;
+
+    record->dir = info & CAPTURE_WRITTEN ? CAPTURE_WRITE : CAPTURE_READ;
+    record->size = info & ~CAPTURE_WRITTEN;
+    r->time += time / 1e6;
+    record->time = r->time;
+    return fread(record->bytes, 1, record->size, r->file) == record->size ? 1 : -1;
+}
+
+void captureReaderClose(t_capture_reader *r)
+{
+    if (r->file != NULL)
+        fclose(r->file);
+    r->file = NULL;
+}
+
+t_capture_dir captureFeedDir(const t_capture_header *header)
+{
+    return header->role == LlRx ? CAPTURE_READ : CAPTURE_WRITE;
+}
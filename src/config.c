@@ -0,0 +1,130 @@
+// Runtime configuration read from the environment
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_ACK_DELAY_MS 20
+
+static t_config config;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+// Sets the variables of the file that aren't set already. Blank lines and
+// lines starting with # are skipped.
+static void loadTuning(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("Couldn't read the tuning file '%s'!\n", path);
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *value = strchr(line, '=');
+        if (line[0] == '#' || value == NULL || strncmp(line, "LL_", 3) != 0)
+            continue;
+        *value++ = '\0';
+        setenv(line, value, 0);
+    }
+    fclose(file);
+}
+
+// "<channel>=<priority>,..." after "prio:". The control channel keeps the
+// highest priority, so data channels go up to 254.
+static void loadPriorities(const char *list)
+{
+    while (*list != '\0')
+    {
+        char *end;
+        unsigned long channel = strtoul(list, &end, 10);
+        unsigned long priority = *end == '=' ? strtoul(end + 1, &end, 10) : 0;
+        if (channel == CONTROL_CHANNEL || channel >= MAX_CHANNELS || priority > 254
+            || (*end != ',' && *end != '\0'))
+        {
+            printf("Invalid LL_MUX priority '%s'!\n", list);
+            return;
+        }
+        config.muxPriority[channel] = priority;
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+static void loadConfig(void)
+{
+    const char *tune = getenv("LL_TUNE");
+    if (tune != NULL && *tune != '\0')
+        loadTuning(tune);
+
+    const char *mux = getenv("LL_MUX");
+    if (mux != NULL && *mux != '\0' && strcmp(mux, "0") != 0)
+    {
+        config.mux = 1;
+        config.muxPolicy = strcmp(mux, "rr") == 0 ? MUX_RR : MUX_PRIO;
+        if (strncmp(mux, "prio:", 5) == 0)
+            loadPriorities(mux + 5);
+    }
+
+    const char *batch = getenv("LL_BATCH");
+    if (batch != NULL && *batch != '\0' && strcmp(batch, "0") != 0)
+    {
+        config.batch = 1;
+        config.coalesce = strcmp(batch, "coalesce") == 0;
+    }
+
+    const char *resume = getenv("LL_RESUME");
+    config.resume = resume != NULL && *resume != '\0' && strcmp(resume, "0") != 0;
+
+    const char *delta = getenv("LL_DELTA");
+    config.delta = delta != NULL && *delta != '\0' && strcmp(delta, "0") != 0;
+
+    const char *sparse = getenv("LL_SPARSE");
+    config.sparse = sparse != NULL && *sparse != '\0' && strcmp(sparse, "0") != 0;
+
+    const char *digest = getenv("LL_DIGEST");
+    config.sha256 = digest != NULL && strcmp(digest, "sha256") == 0;
+
+    const char *aggregate = getenv("LL_AGGREGATE");
+    config.aggregate = aggregate != NULL && *aggregate != '\0' && strcmp(aggregate, "0") != 0;
+
+    const char *chunk = getenv("LL_CHUNK");
+    config.chunk = chunk != NULL ? strtoul(chunk, NULL, 10) : 0;
+
+    const char *timeout = getenv("LL_TIMEOUT_MS");
+    config.timeout = timeout != NULL ? atof(timeout) / 1000.0 : 0;
+
+    const char *retries = getenv("LL_RETRIES");
+    config.retries = retries != NULL ? atoi(retries) : -1;
+
+    const char *metrics = getenv("LL_METRICS");
+    config.metricsFile = metrics != NULL && *metrics != '\0' ? metrics : NULL;
+
+    const char *telemetry = getenv("LL_TELEMETRY");
+    config.telemetry = telemetry != NULL && *telemetry != '\0' ? telemetry : NULL;
+
+    const char *capture = getenv("LL_CAPTURE");
+    config.capture = capture != NULL && *capture != '\0' ? capture : NULL;
+
+    config.duplexSend = getenv("LL_DUPLEX_SEND");
+    config.duplexRecv = getenv("LL_DUPLEX_RECV");
+
+    // Acknowledgements are only worth delaying when I-frames flow both ways
+    if (config.duplexSend != NULL || config.duplexRecv != NULL)
+    {
+        const char *delay = getenv("LL_ACK_DELAY_MS");
+        config.ackDelay = (delay != NULL ? atof(delay) : DEFAULT_ACK_DELAY_MS) / 1000.0;
+    }
+}
+
+// Loaded once, by whichever thread asks first; the others wait for it
+const t_config *getConfig(void)
+{
+    pthread_once(&once, loadConfig);
+    return &config;
+}
@@ -0,0 +1,169 @@
+// Block signatures and matching for delta transfers
+
+#include "delta.h"
+
+#include <string.h>
+
+#include "utils.h"
+
+#define STRONG_PRIME1 0x9E3779B185EBCA87ULL
+#define STRONG_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+// rsync's weak checksum: a is the sum of the bytes, b the sum of the
+// running sums, both mod 2^16. Four bytes are folded per step, so the loop
+// carries no dependency between the bytes of a step.
+uint32_t deltaWeak(const uint8_t *data, size_t size)
+{
+    uint32_t a = 0, b = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= size; i += 4)
+    {
+        b += 4 * a + 4 * data[i] + 3 * data[i + 1] + 2 * data[i + 2] + data[i + 3];
+        a += data[i] + data[i + 1] + data[i + 2] + data[i + 3];
+    }
+    for (; i < size; i++)
+    {
+        a += data[i];
+        b += a;
+    }
+
+    return (a & 0xFFFF) | (b << 16);
+}
+
+// Slides the window one byte: out leaves it, in enters it
+uint32_t deltaRoll(uint32_t weak, uint8_t out, uint8_t in, size_t size)
+{
+    uint32_t a = weak & 0xFFFF;
+    uint32_t b = weak >> 16;
+
+    a = (a - out + in) & 0xFFFF;
+    b = (b - size * out + a) & 0xFFFF;
+    return a | (b << 16);
+}
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// 64 bit multiply / rotate hash over four independent lanes of 8 byte words
+uint64_t deltaStrong(const uint8_t *data, size_t size)
+{
+    uint64_t lanes[4] = {STRONG_PRIME1, STRONG_PRIME2, ~STRONG_PRIME1, ~STRONG_PRIME2};
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32)
+    {
+        uint64_t words[4];
+        memcpy(words, data + i, sizeof(words));
+        for (int k = 0; k < 4; k++)
+            lanes[k] = rotl64(lanes[k] ^ (words[k] * STRONG_PRIME2), 31) * STRONG_PRIME1;
+    }
+
+    uint64_t h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    for (; i < size; i++)
+        h = rotl64(h ^ (data[i] * STRONG_PRIME1), 11) * STRONG_PRIME2;
+
+    h ^= size;
+    h ^= h >> 33;
+    h *= STRONG_PRIME2;
+    h ^= h >> 29;
+    h *= STRONG_PRIME1;
+    h ^= h >> 32;
+    return h;
+}
+
+int deltaSignatures(FILE *file, t_delta_sig **sigs, size_t *count)
+{
+    if (file == NULL || sigs == NULL || count == NULL)
+        return err("deltaSignatures", "Invalid arguments");
+
+    size_t capacity = 64;
+    *count = 0;
+    *sigs = malloc(capacity * sizeof(t_delta_sig));
+    if (*sigs == NULL)
+        return err("deltaSignatures", "Couldn't allocate signatures");
+
+    uint8_t block[DELTA_BLOCK];
+    while (fread(block, 1, DELTA_BLOCK, file) == DELTA_BLOCK)
+    {
+        if (*count == capacity)
+        {
+            t_delta_sig *bigger = realloc(*sigs, 2 * capacity * sizeof(t_delta_sig));
+            if (bigger == NULL)
+                return free(*sigs), *sigs = NULL, err("deltaSignatures", "Couldn't allocate signatures");
+            *sigs = bigger;
+            capacity *= 2;
+        }
+
+        (*sigs)[*count].weak = deltaWeak(block, DELTA_BLOCK);
+        (*sigs)[*count].strong = deltaStrong(block, DELTA_BLOCK);
+        (*count)++;
+    }
+
+    return 0;
+}
+
+////////////////////////////////////////////////
+// INDEX
+////////////////////////////////////////////////
+static size_t slotOf(const t_delta_index *index, uint32_t weak)
+{
+    return ((weak * 0x9E3779B1u) >> 7) & index->mask;
+}
+
+int deltaIndexInit(t_delta_index *index, const t_delta_sig *sigs, size_t count)
+{
+    size_t size = 16;
+    while (size < 2 * count)
+        size *= 2;
+
+    index->sigs = sigs;
+    index->count = count;
+    index->mask = size - 1;
+    index->slots = malloc(size * sizeof(int32_t));
+    if (index->slots == NULL)
+        return err("deltaIndexInit", "Couldn't allocate index");
+    memset(index->slots, 0xFF, size * sizeof(int32_t));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t slot = slotOf(index, sigs[i].weak);
+        while (index->slots[slot] >= 0)
+            slot = (slot + 1) & index->mask;
+        index->slots[slot] = i;
+    }
+
+    return 0;
+}
+
+long deltaIndexFind(const t_delta_index *index, uint32_t weak, const uint8_t *data)
+{
+    int hasStrong = 0;
+    uint64_t strong = 0;
+
+    for (size_t slot = slotOf(index, weak); index->slots[slot] >= 0; slot = (slot + 1) & index->mask)
+    {
+        const t_delta_sig *sig = &index->sigs[index->slots[slot]];
+        if (sig->weak != weak)
+            continue;
+
+        // Only hash the window once some block shares its weak checksum
+        if (!hasStrong)
+        {
+            strong = deltaStrong(data, DELTA_BLOCK);
+            hasStrong = 1;
+        }
+        if (sig->strong == strong)
+            return index->slots[slot];
+    }
+
+    return -1;
+}
+
+void deltaIndexFree(t_delta_index *index)
+{
+    free(index->slots);
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,242 @@
+// CRC32C and SHA-256 for end-to-end file checks
+
+#include "digest.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crcTable[8][256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void crcTableInit(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crcTable[0][n] = crc;
+    }
+
+    for (uint32_t n = 0; n < 256; n++)
+        for (int k = 1; k < 8; k++)
+            crcTable[k][n] = (crcTable[k - 1][n] >> 8) ^ crcTable[0][crcTable[k - 1][n] & 0xFF];
+}
+
+// Slicing-by-8: eight table lookups per 8 bytes instead of a loop per byte
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t size)
+{
+    pthread_once(&crcOnce, crcTableInit);
+    crc = ~crc;
+
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        uint32_t lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+        uint32_t hi = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+        crc = crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF] ^
+              crcTable[5][(lo >> 16) & 0xFF] ^ crcTable[4][lo >> 24] ^
+              crcTable[3][hi & 0xFF] ^ crcTable[2][(hi >> 8) & 0xFF] ^
+              crcTable[1][(hi >> 16) & 0xFF] ^ crcTable[0][hi >> 24];
+    }
+    for (; size > 0; size--, data++)
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *data) & 0xFF];
+
+    return ~crc;
+}
+
+// Feeding zero bytes to the CRC register is linear, so n of them are one
+// 32x32 GF(2) matrix raised to the n-th power (as in zlib's crc32_combine)
+static uint32_t gf2Times(const uint32_t *matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+    for (; vector; vector >>= 1, matrix++)
+        if (vector & 1)
+            sum ^= *matrix;
+    return sum;
+}
+
+static void gf2Square(uint32_t *square, const uint32_t *matrix)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2Times(matrix, matrix[n]);
+}
+
+static uint32_t crc32cZeros(uint32_t crc, uint64_t size)
+{
+    uint32_t even[32], odd[32];
+
+    // Operator for one zero bit, then two and four bits
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+    gf2Square(even, odd);
+    gf2Square(odd, even);
+
+    uint32_t reg = ~crc;
+    while (size > 0)
+    {
+        gf2Square(even, odd);
+        if (size & 1)
+            reg = gf2Times(even, reg);
+        size >>= 1;
+        if (size == 0)
+            break;
+
+        gf2Square(odd, even);
+        if (size & 1)
+            reg = gf2Times(odd, reg);
+        size >>= 1;
+    }
+    return ~reg;
+}
+
+////////////////////////////////////////////////
+// SHA-256
+////////////////////////////////////////////////
+static const uint32_t shaK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256Block(uint32_t state[8], const uint8_t *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + shaK[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void sha256Init(t_sha256 *sha)
+{
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(sha->state, init, sizeof(init));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+void sha256Update(t_sha256 *sha, const uint8_t *data, size_t size)
+{
+    sha->length += size;
+
+    if (sha->used > 0)
+    {
+        size_t n = 64 - sha->used < size ? 64 - sha->used : size;
+        memcpy(sha->block + sha->used, data, n);
+        sha->used += n;
+        data += n;
+        size -= n;
+        if (sha->used < 64)
+            return;
+        sha256Block(sha->state, sha->block);
+        sha->used = 0;
+    }
+
+    for (; size >= 64; size -= 64, data += 64)
+        sha256Block(sha->state, data);
+
+    memcpy(sha->block, data, size);
+    sha->used = size;
+}
+
+void sha256Final(t_sha256 *sha, uint8_t out[SHA256_SIZE])
+{
+    uint64_t bits = sha->length * 8;
+    uint8_t pad[72] = {0x80};
+    size_t padSize = (sha->used < 56 ? 56 : 120) - sha->used;
+
+    for (int i = 0; i < 8; i++)
+        pad[padSize + i] = bits >> (56 - 8 * i);
+    sha256Update(sha, pad, padSize + 8);
+
+    for (int i = 0; i < 8; i++)
+    {
+        out[4 * i] = sha->state[i] >> 24;
+        out[4 * i + 1] = sha->state[i] >> 16;
+        out[4 * i + 2] = sha->state[i] >> 8;
+        out[4 * i + 3] = sha->state[i];
+    }
+}
+
+////////////////////////////////////////////////
+// DIGEST
+////////////////////////////////////////////////
+void digestInit(t_digest *digest, int sha)
+{
+    digest->crc = 0;
+    digest->sha = sha;
+    if (sha)
+        sha256Init(&digest->sha256);
+}
+
+void digestUpdate(t_digest *digest, const uint8_t *data, size_t size)
+{
+    digest->crc = crc32c(digest->crc, data, size);
+    if (digest->sha)
+        sha256Update(&digest->sha256, data, size);
+}
+
+void digestZeros(t_digest *digest, uint64_t size)
+{
+    pthread_once(&crcOnce, crcTableInit);
+    digest->crc = crc32cZeros(digest->crc, size);
+
+    // SHA-256 has no shortcut, the zeros really are hashed
+    static const uint8_t zeros[4096] = {0};
+    for (uint64_t n = 0; digest->sha && size > 0; size -= n)
+    {
+        n = size < sizeof(zeros) ? size : sizeof(zeros);
+        sha256Update(&digest->sha256, zeros, n);
+    }
+}
+
+uint32_t digestCrc(const t_digest *digest)
+{
+    return digest->crc;
+}
+
+void digestSha(t_digest *digest, uint8_t out[SHA256_SIZE])
+{
+    sha256Final(&digest->sha256, out);
+}
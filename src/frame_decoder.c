@@ -0,0 +1,217 @@
+// Table-driven frame decoder
+
+#include "frame_decoder.h"
+
+#include <string.h>
+
+#include "link_ext.h"
+#include "trace.h"
+#include "utils.h"
+
+typedef enum
+{
+    BYTE_OTHER,
+    BYTE_FLAG,
+    BYTE_CLASSES
+}   t_byte_class;
+
+typedef enum
+{
+    ACT_NONE,       // Stay, e.g. FLAG after FLAG
+    ACT_HUNT,       // Skip to the next FLAG
+    ACT_OPEN,       // FLAG: a new frame starts, whatever came before is dropped
+    ACT_ADDR,
+    ACT_CTRL,
+    ACT_BCC1,
+    ACT_BODY,       // Copy and destuff up to the next FLAG
+    ACT_END,        // FLAG closing a frame with a good header
+    ACT_SKIP,       // Count the bytes of a damaged frame up to the next FLAG
+    ACT_DAMAGED     // FLAG closing a damaged frame
+}   t_action;
+
+static const uint8_t actions[STOP + 1][BYTE_CLASSES] = {
+    [START] = {ACT_HUNT, ACT_OPEN},
+    [FLAG_RCV] = {ACT_ADDR, ACT_NONE},
+    [A_RCV] = {ACT_CTRL, ACT_OPEN},
+    [C_RCV] = {ACT_BCC1, ACT_OPEN},
+    [BCC_OK] = {ACT_BODY, ACT_END},
+    [DATA_RCV] = {ACT_BODY, ACT_END},
+    [HDR_ERR] = {ACT_SKIP, ACT_DAMAGED},
+    [STOP] = {ACT_HUNT, ACT_OPEN},
+};
+
+void frameDecoderInit(t_decoder *d)
+{
+    memset(d, 0, sizeof(*d));
+    d->state = START;
+}
+
+static int isAddress(uint8_t byte)
+{
+    return (ADDR_BASE(byte) == ADDR_SEND || ADDR_BASE(byte) == ADDR_RCV) && ADDR_CH(byte) < MAX_CHANNELS;
+}
+
+static int isSupervisory(uint8_t c)
+{
+    return c == CTRL_RR0 || c == CTRL_RR1 || c == CTRL_REJ0 || c == CTRL_REJ1 ||
+           c == CTRL_RNR0 || c == CTRL_RNR1;
+}
+
+static size_t toFlag(const uint8_t *bytes, size_t size)
+{
+    const uint8_t *flag = memchr(bytes, FLAG, size);
+    return flag != NULL ? (size_t)(flag - bytes) : size;
+}
+
+// Copies bytes (which hold no FLAG) into the body, undoing the stuffing a run
+// at a time. Returns FALSE when the body grows past what a frame can hold.
+static int appendBody(t_decoder *d, const uint8_t *bytes, size_t size)
+{
+    while (size > 0)
+    {
+        if (d->escaped)
+        {
+            if (d->size == sizeof(d->buf))
+                return FALSE;
+            d->buf[d->size++] = *bytes++ ^ ESCAPE_OFFSET;
+            d->escaped = FALSE;
+            size--;
+            continue;
+        }
+
+        const uint8_t *escape = memchr(bytes, ESCAPE, size);
+        size_t run = escape != NULL ? (size_t)(escape - bytes) : size;
+        if (run > sizeof(d->buf) - d->size)
+            return FALSE;
+
+        memcpy(d->buf + d->size, bytes, run);
+        d->size += run;
+        bytes += run;
+        size -= run;
+
+        if (escape != NULL)
+        {
+            d->escaped = TRUE;
+            bytes++;
+            size--;
+        }
+    }
+
+    return TRUE;
+}
+
+// Turns the body collected since BCC1 into a frame. Returns FALSE for bodies
+// no frame can have, which are dropped as before.
+static int finishFrame(t_decoder *d, t_decoded_frame *frame)
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->a = d->a;
+    frame->c = d->c;
+
+    if (!IS_INFO(d->c))
+    {
+        frame->kind = isSupervisory(d->c) ? FRAME_S : FRAME_U;
+        return d->size == 0;
+    }
+
+    if (d->size == 0)
+        return FALSE;
+
+    TRACE_BEGIN(TR_BCC_CHECK);
+    uint8_t bcc2 = 0x00;
+    for (size_t i = 0; i + 1 < d->size; i++)
+        bcc2 ^= d->buf[i];
+    TRACE_END(TR_BCC_CHECK);
+
+    frame->kind = FRAME_I;
+    frame->data = d->buf;
+    frame->size = d->size - 1;
+    frame->valid = bcc2 == d->buf[d->size - 1];
+    return TRUE;
+}
+
+int frameDecode(t_decoder *d, const uint8_t **bytes, size_t *size, t_decoded_frame *frame)
+{
+    const uint8_t *p = *bytes;
+    const uint8_t *end = p + *size;
+    int found = FALSE;
+
+    while (p < end && !found)
+    {
+        uint8_t byte = *p;
+        size_t n = 1;
+
+        switch (actions[d->state][byte == FLAG ? BYTE_FLAG : BYTE_OTHER])
+        {
+        case ACT_NONE:
+            d->opened = TRUE;
+            break;
+
+        case ACT_HUNT:
+            n = toFlag(p, end - p);
+            break;
+
+        case ACT_OPEN:
+            d->state = FLAG_RCV;
+            d->opened = TRUE;
+            break;
+
+        case ACT_ADDR:
+            d->a = isAddress(byte) ? byte : 0;
+            d->size = 0;
+            d->state = d->a != 0 ? A_RCV : HDR_ERR;
+            break;
+
+        case ACT_CTRL:
+            d->c = byte;
+            d->state = C_RCV;
+            break;
+
+        case ACT_BCC1:
+            d->size = 0;
+            d->escaped = FALSE;
+            d->state = byte == (d->a ^ d->c) ? DATA_RCV : HDR_ERR;
+            break;
+
+        case ACT_BODY:
+            n = toFlag(p, end - p);
+            if (!appendBody(d, p, n))
+            {
+                info("llread", "Payload is too big! Returning to start");
+                d->state = START;
+            }
+            break;
+
+        case ACT_END:
+            d->state = FLAG_RCV;
+            found = finishFrame(d, frame);
+            frame->fragment = !d->opened;
+            d->opened = FALSE;
+            break;
+
+        case ACT_SKIP:
+            n = toFlag(p, end - p);
+            d->size += n;
+            if (d->size > 2 * sizeof(d->buf))
+                d->state = START;
+            break;
+
+        case ACT_DAMAGED:
+            d->state = FLAG_RCV;
+            memset(frame, 0, sizeof(*frame));
+            frame->kind = FRAME_DAMAGED;
+            frame->a = d->a;
+            frame->skipped = d->size;
+            frame->fragment = !d->opened;
+            d->opened = FALSE;
+            found = TRUE;
+            break;
+        }
+
+        p += n;
+    }
+
+    *size -= p - *bytes;
+    *bytes = p;
+    return found;
+}
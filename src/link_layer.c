@@ -2,46 +2,188 @@
 
 #include "link_layer.h"
 
-#include <signal.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "capture.h"
+#include "config.h"
+#include "frame_decoder.h"
+#include "link_ext.h"
+#include "log.h"
+#include "metrics.h"
 #include "protocol.h"
-#include "serial_port.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "transport.h"
 #include "utils.h"
 
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
 
-LinkLayer connectionParameters;
-t_statistics stats = {0};
-int frameNumber = 0;
+#define RX_QUEUE_LEN 8
+#define POLL_MS 100
+#define READ_CHUNK 4096
 
-// Alarm
-int alarmEnabled = FALSE;
-int alarmCount = 0;
+// Only packets up to this size wait for others to share their I-frame
+#define AGG_PACKET_MAX (MAX_PAYLOAD_SIZE / 4)
 
-void alarmHandler(int signal)
+typedef enum
 {
-    alarmCount++;
-    alarmEnabled = TRUE;
-    printf("[alarmHandler] Alarm %d\n", alarmCount);
+    U_SET,
+    U_UA,
+    U_DISC,
+    U_COUNT
+}   t_u_index;
+
+typedef enum
+{
+    S_RR,
+    S_REJ,
+    S_RNR
+}   t_s_kind;
+
+typedef struct s_rx_packet
+{
+    uint8_t     data[MAX_PAYLOAD_SIZE];
+    size_t      size;
+    uint8_t     channel;
+    int         aggregate;
+    size_t      offset;     // Next record of an aggregate frame
+}   t_rx_packet;
+
+// One open connection. A reader thread decodes every incoming frame, answers
+// I-frames and wakes up whoever is waiting in llwrite / llread / llclose.
+struct s_link
+{
+    LinkLayer       params;
+    t_transport     *tp;
+    t_capture       *capture;   // LL_CAPTURE
+    t_frame_addr    cmdAddr;    // Address of the commands (and I-frames) we send
+    t_frame_addr    peerAddr;   // Address of the commands the peer sends
+    double          timeout;    // Seconds, LL_TIMEOUT_MS or the one llopen was given
+    int             connected;
+    int             failed;
+    int             closing;
+    int             readers;    // Threads blocked in llread
+
+    pthread_t       reader;
+    int             running;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_mutex_t writeLock;
+    pthread_mutex_t sendLock;   // One I-frame in flight at a time
+
+    // Sender side
+    uint8_t         ns[MAX_CHANNELS];
+    int             sending[MAX_CHANNELS];  // Threads in llwrite on the channel
+    int             outstanding;
+    uint8_t         outChannel;
+    int             acked;
+    int             rejected;
+    int             paused;     // Receiver answered RNR, stop retransmitting
+    int             resumed;    // Receiver sent RR after RNR, retransmit now
+    int             retryNow;   // Answer arrived damaged, don't wait for the timeout
+
+    // Small packets waiting to share an I-frame (LL_AGGREGATE)
+    int             aggregate;
+    uint8_t         pending[MAX_PAYLOAD_SIZE];
+    size_t          pendingSize;
+    int             pendingCount;
+    uint8_t         pendingChannel;
+
+    // Receiver side
+    uint8_t         nr[MAX_CHANNELS];
+    int             ackOwed[MAX_CHANNELS];
+    struct timespec ackDeadline[MAX_CHANNELS];
+    double          ackDelay;
+    t_rx_packet     queue[RX_QUEUE_LEN];
+    size_t          queueHead;
+    size_t          queueCount;
+    int             rnrSent[MAX_CHANNELS];
+    int             rejSent[MAX_CHANNELS];     // For nr, since the last valid frame
+    uint8_t         lastChannel;    // Of the last I-frame accepted
+
+    int             uSeen[2][U_COUNT];
+    t_decoder       decoder;
+    t_statistics    stats;
+    t_metrics       metrics;
+};
+
+static __thread t_link *ll = NULL;
+
+t_link *llcurrent(void)
+{
+    return ll;
 }
 
-void alarmDisable()
+void lluse(t_link *link)
+{
+    ll = link;
+}
+
+////////////////////////////////////////////////
+// TELEMETRY
+////////////////////////////////////////////////
+// Copies the link counters to the LL_TELEMETRY segment. The caller holds lock.
+static void publishTelemetry(t_link *link)
 {
-    alarm(0);
-    alarmEnabled = FALSE;
-    alarmCount = 0;
+    t_telemetry *t = telemetryBegin();
+    if (t == NULL)
+        return;
+
+    const t_metrics *m = &link->metrics;
+    t->role = link->params.role;
+    t->state = link->closing ? TM_CLOSED : TM_OPEN;
+    t->baudRate = link->params.baudRate;
+    t->rtoMs = link->timeout * 1000;
+    t->payload = link->params.role == LlTx ? m->payloadAcked : m->payloadReceived;
+    t->framesSent = m->framesSent;
+    t->framesReceived = m->framesReceived;
+    t->retransmits = m->retxTimeout + m->retxRej + m->retxDamaged + m->retxRnr;
+    t->errors = link->stats.n_errors;
+    t->srttUs = m->srtt;
+    t->windowUsed = link->outstanding;
+    t->windowSize = 1;
+    t->aggregated = link->pendingSize;
+    t->rxQueued = link->queueCount;
+    t->rxQueueSize = RX_QUEUE_LEN;
+    telemetryEnd(t);
 }
 
+////////////////////////////////////////////////
+// TIME
+////////////////////////////////////////////////
+static struct timespec deadlineAfter(double seconds)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    long nsec = (long)((seconds - (long)seconds) * 1e9);
+    t.tv_sec += (long)seconds + (t.tv_nsec + nsec) / 1000000000L;
+    t.tv_nsec = (t.tv_nsec + nsec) % 1000000000L;
+    return t;
+}
+
+static double secondsUntil(struct timespec deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (deadline.tv_sec - now.tv_sec) + (deadline.tv_nsec - now.tv_nsec) / 1e9;
+}
+
+////////////////////////////////////////////////
+// FRAMES
+////////////////////////////////////////////////
 t_frame newFrame(t_frame_addr addr, t_frame_ctrl ctrl, uint8_t *data, size_t dataSize)
 {
-    if ((ctrl == CTRL_INFO0 || ctrl == CTRL_INFO1) && data == NULL)
+    if (IS_INFO(ctrl) && data == NULL)
         return info("newFrame", "INFO frames require data fields"), (t_frame){0};
 
     t_frame ret;
@@ -59,7 +201,7 @@ t_frame newFrame(t_frame_addr addr, t_frame_ctrl ctrl, uint8_t *data, size_t dat
         ret.bcc2 ^= data[i];
     }
 
-    if (ret.bcc2 == FLAG || ret.bcc2 == FLAG)
+    if (ret.bcc2 == FLAG || ret.bcc2 == ESCAPE)
         ret.bytesToStuff += 1;
 
     ret.dataSize = dataSize;
@@ -76,7 +218,7 @@ uint8_t *frameToString(t_frame *frame, size_t *finalSize)
     if (finalSize == NULL)
         return info("frameToString", "Can't save final size to NULL pointer"), NULL;
 
-    int isInfoFrame = frame->c == CTRL_INFO0 || frame->c == CTRL_INFO1;
+    int isInfoFrame = IS_INFO(frame->c);
 
     uint8_t *ret = calloc(5 + isInfoFrame + frame->bytesToStuff + frame->dataSize, sizeof(uint8_t));
     if (ret == NULL)
@@ -129,507 +271,945 @@ t_frame newSUFrame(t_frame_addr addr, t_frame_ctrl ctrl)
     return newFrame(addr, ctrl, NULL, 0);
 }
 
-int writeFrameToSerialPort(t_frame frame)
+static int writeAll(t_link *link, const uint8_t *bytes, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        int retv = link->tp->ops->write(link->tp, bytes + done, size - done);
+        if (retv < 0)
+            return -1;
+        captureBytes(link->capture, CAPTURE_WRITE, bytes + done, retv);
+        done += retv;
+    }
+    return done;
+}
+
+static int writeFrame(t_link *link, t_frame frame)
 {
     size_t size = 0;
+    TRACE_BEGIN(TR_FRAME_BUILD);
     uint8_t *string = frameToString(&frame, &size);
+    TRACE_END(TR_FRAME_BUILD);
     if (string == NULL)
         return -1;
 
-    int retv = writeBytesSerialPort(string, size);
+    pthread_mutex_lock(&link->writeLock);
+    TRACE_BEGIN(TR_SERIAL_WRITE);
+    int retv = writeAll(link, string, size);
+    TRACE_END(TR_SERIAL_WRITE);
+    pthread_mutex_unlock(&link->writeLock);
+
     return free(string), retv;
 }
 
-int frameDestuff(t_frame *frame)
+////////////////////////////////////////////////
+// READER THREAD
+////////////////////////////////////////////////
+static int uIndex(uint8_t ctrl)
 {
-    if (frame == NULL)
-        return err("frameDestuff", "Can't destuff NULL frame");
+    switch (ctrl)
+    {
+    case CTRL_SET:
+        return U_SET;
+    case CTRL_UA:
+        return U_UA;
+    case CTRL_DISC:
+        return U_DISC;
+    default:
+        return -1;
+    }
+}
 
-    if (frame->data == NULL)
-        return err("frameDestuff", "Can't destuff NULL data");
+// Called with the lock held
+static void sendAck(t_link *link, uint8_t channel)
+{
+    t_frame_ctrl ctrl = link->nr[channel] ? CTRL_RR1 : CTRL_RR0;
+    link->ackOwed[channel] = FALSE;
 
-    size_t stuffedSize = frame->dataSize;
+    if (writeFrame(link, newSUFrame(ADDR_CHANNEL(link->peerAddr, channel), ctrl)) < 0)
+        spError("llread", FALSE);
+}
 
-    size_t index = 0;
-    for (int i = 0; i < stuffedSize; i++)
+// Called with the lock held. An acknowledgement is either a RR / REJ / RNR
+// frame or the N(R) bit piggybacked on an I-frame coming the other way.
+static void handleAck(t_link *link, uint8_t channel, uint8_t nr, t_s_kind kind)
+{
+    if (!link->outstanding || link->outChannel != channel)
+        return;
+
+    int isAck = nr != link->ns[channel];
+
+    switch (kind)
     {
-        uint8_t c = frame->data[i];
-        if (c == ESCAPE && i < stuffedSize - 1)
+    case S_RR:
+        if (isAck)
+            link->acked = TRUE;
+        else if (link->paused)
+            link->resumed = TRUE;
+        else
+            return;
+        break;
+
+    case S_REJ:
+        if (isAck)
+            return;
+        link->rejected = TRUE;
+        break;
+
+    case S_RNR:
+        if (isAck)
         {
-            i++;
-            frame->data[index++] = frame->data[i] ^ ESCAPE_OFFSET;
-            continue;
+            link->acked = TRUE;
+            break;
         }
-
-        frame->data[index++] = frame->data[i];
+        link->paused = TRUE;
+        return;
     }
 
-    frame->bcc2 = frame->data[index - 1];
-    frame->dataSize = index - 1;
+    pthread_cond_broadcast(&link->cond);
+}
 
-    return 0;
+// Called with the lock held, once the application freed a slot of the queue
+static void sendReady(t_link *link)
+{
+    for (int i = 0; i < MAX_CHANNELS; i++)
+    {
+        if (!link->rnrSent[i])
+            continue;
+
+        link->rnrSent[i] = FALSE;
+        sendAck(link, i);
+    }
 }
 
-int receiveFrame(t_frame expected)
+static void handleSU(t_link *link, uint8_t a, uint8_t c)
 {
-    t_state state = START;
+    uint8_t channel = ADDR_CH(a);
 
-    while (state != STOP)
+    pthread_mutex_lock(&link->lock);
+
+    switch (c)
     {
-        uint8_t buf = 0;
-        int retv = readByteSerialPort(&buf);
+    case CTRL_RR0:
+    case CTRL_RR1:
+        if (ADDR_BASE(a) == link->cmdAddr)
+            handleAck(link, channel, c == CTRL_RR1, S_RR);
+        break;
 
-        if (retv < 0)
-            return spError("receiveFrame", TRUE);
+    case CTRL_REJ0:
+    case CTRL_REJ1:
+        if (ADDR_BASE(a) == link->cmdAddr)
+            handleAck(link, channel, c == CTRL_REJ1, S_REJ);
+        break;
 
-        if (retv > 0)
-        {
-            switch (state)
-            {
-            case START:
-                if (buf == FLAG)
-                    state = FLAG_RCV;
-                break;
+    case CTRL_RNR0:
+    case CTRL_RNR1:
+        if (ADDR_BASE(a) == link->cmdAddr)
+            handleAck(link, channel, c == CTRL_RNR1, S_RNR);
+        break;
 
-            case FLAG_RCV:
-                if (buf == FLAG)
-                    continue;
-                if (buf == expected.a)
-                    state = A_RCV;
-                else
-                    state = START;
-                break;
+    default:
+        if (uIndex(c) < 0 || channel != CONTROL_CHANNEL)
+            break;
 
-            case A_RCV:
-                if (buf == expected.c)
-                    state = C_RCV;
-                else if (buf == FLAG)
-                    state = FLAG_RCV;
-                else
-                    state = START;
-                break;
+        link->uSeen[a == ADDR_SEND][uIndex(c)]++;
 
-            case C_RCV:
-                if (buf == (expected.c ^ expected.a))
-                    state = BCC_OK;
-                else if (buf == FLAG)
-                    state = FLAG_RCV;
-                else
-                    state = START;
-                break;
+        // The transmitter is disconnecting, nothing else will arrive
+        if (c == CTRL_DISC && link->params.role == LlRx)
+            link->closing = TRUE;
 
-            case BCC_OK:
-                if (buf == FLAG)
-                    state = STOP;
-                else
-                    state = START;
-                break;
+        // The receiver may send its first I-frame right after this UA, before
+        // llopen gets the lock back
+        if (c == CTRL_UA && a == ADDR_SEND && link->params.role == LlTx)
+            link->connected = TRUE;
 
-            default:
-                state = START;
-            }
+        pthread_cond_broadcast(&link->cond);
+
+        // Either our UA got lost or the transmitter opened a new connection:
+        // both start over from sequence number 0
+        if (c == CTRL_SET && link->connected && link->params.role == LlRx)
+        {
+            memset(link->ns, 0, sizeof(link->ns));
+            memset(link->nr, 0, sizeof(link->nr));
+            memset(link->ackOwed, 0, sizeof(link->ackOwed));
+            memset(link->rejSent, 0, sizeof(link->rejSent));
+            writeFrame(link, UA_Rx_Response);
         }
+        break;
     }
 
-    return 0;
+    pthread_mutex_unlock(&link->lock);
 }
 
-int transmitFrame(t_frame toSend, t_frame expected)
+// Called with the lock held. Asks for the frame expected on the channel again.
+// A FLAG made up by a bit error splits one frame in two, both damaged: only the
+// first is rejected, a second REJ would have it sent twice more. Returns
+// whether the REJ was sent.
+static int sendRej(t_link *link, uint8_t channel, int fragment)
 {
-    t_state state = START;
+    if (fragment && link->rejSent[channel])
+        return FALSE;
+
+    t_frame_ctrl ctrl = link->nr[channel] ? CTRL_REJ1 : CTRL_REJ0;
+    if (writeFrame(link, newSUFrame(ADDR_CHANNEL(link->peerAddr, channel), ctrl)) < 0)
+        spError("llread", FALSE);
+    link->rejSent[channel] = TRUE;
+    return TRUE;
+}
 
-    (void)signal(SIGALRM, alarmHandler);
+static void handleInfo(t_link *link, uint8_t a, uint8_t c, const uint8_t *data, size_t size, int valid,
+                       int fragment)
+{
+    if (ADDR_BASE(a) != link->peerAddr || !link->connected)
+        return;
 
-    size_t size = 0;
-    uint8_t *frameString = frameToString(&toSend, &size);
-    if (frameString == NULL)
-        return -1;
-    if (writeBytesSerialPort(frameString, size) < 0)
-        return free(frameString), spError("transmitFrame", FALSE);
+    uint8_t channel = ADDR_CH(a);
+    uint8_t ns = (c & INFO_NS) != 0;
 
-    alarm(connectionParameters.timeout);
+    pthread_mutex_lock(&link->lock);
 
-    while (state != STOP && alarmCount <= connectionParameters.nRetransmissions)
+    if (!valid)
     {
-        uint8_t buf = 0;
-        int retv = readByteSerialPort(&buf);
+        sendRej(link, channel, fragment);
+        logWarn("llread", "Invalid frame, trying again...");
+        link->stats.n_errors++;
+        pthread_mutex_unlock(&link->lock);
+        return;
+    }
 
-        if (retv < 0)
-            return spError("transmitFrame", TRUE);
+    handleAck(link, channel, (c & INFO_NR) != 0, S_RR);
+    link->rejSent[channel] = FALSE;
 
-        if (retv > 0)
-        {
-            switch (state)
-            {
-            case START:
-                if (buf == FLAG)
-                    state = FLAG_RCV;
-                break;
+    if (ns != link->nr[channel])
+    {
+        info("llread", "Received duplicate frame");
+        sendAck(link, channel);
+        pthread_mutex_unlock(&link->lock);
+        return;
+    }
 
-            case FLAG_RCV:
-                state = START;
-                if (buf == FLAG)
-                    continue;
-                if (buf == expected.a)
-                    state = A_RCV;
-                break;
+    // The application is not keeping up: the frame is refused and the
+    // transmitter waits until llread frees a slot and we send RR
+    if (link->queueCount == RX_QUEUE_LEN)
+    {
+        t_frame_ctrl ctrl = link->nr[channel] ? CTRL_RNR1 : CTRL_RNR0;
+        if (writeFrame(link, newSUFrame(a, ctrl)) < 0)
+            spError("llread", FALSE);
 
-            case A_RCV:
-                state = START;
-                if (buf == expected.c)
-                    state = C_RCV;
-                else if (buf == FLAG)
-                    state = FLAG_RCV;
-                break;
+        if (!link->rnrSent[channel])
+        {
+            info("llread", "Receiver not ready, queue is full");
+            link->stats.n_rnr++;
+        }
+        link->rnrSent[channel] = TRUE;
+        pthread_mutex_unlock(&link->lock);
+        return;
+    }
 
-            case C_RCV:
-                state = START;
-                if (buf == (expected.c ^ expected.a))
-                    state = BCC_OK;
-                if (buf == FLAG)
-                    state = FLAG_RCV;
-                break;
+    t_rx_packet *packet = &link->queue[(link->queueHead + link->queueCount) % RX_QUEUE_LEN];
+    memcpy(packet->data, data, size);
+    packet->size = size;
+    packet->channel = channel;
+    packet->aggregate = (c & INFO_AGG) != 0;
+    packet->offset = 0;
+    link->queueCount++;
+
+    link->nr[channel] ^= 1;
+    link->lastChannel = channel;
+    link->stats.bytes_read += size + 6;
+    link->stats.n_frames++;
+    link->metrics.framesReceived++;
+    publishTelemetry(link);
+
+    // Give an outgoing I-frame the chance to carry the acknowledgement, when
+    // one is on its way: otherwise waiting only slows the peer down
+    int frameComing = link->sending[channel] > 0 || (link->outstanding && link->outChannel == channel) ||
+                      (link->pendingCount > 0 && link->pendingChannel == channel);
+    if (link->ackDelay > 0 && frameComing)
+    {
+        link->ackOwed[channel] = TRUE;
+        link->ackDeadline[channel] = deadlineAfter(link->ackDelay);
+    }
+    else
+    {
+        sendAck(link, channel);
+    }
 
-            case BCC_OK:
-                state = START;
-                if (buf == FLAG)
-                    state = STOP;
-                break;
+    pthread_cond_broadcast(&link->cond);
+    pthread_mutex_unlock(&link->lock);
+}
 
-            default:
-                state = START;
-            }
-        }
+// A frame whose header failed the checks, seen when the next FLAG closes it.
+// a is 0 when the address itself was invalid, size counts the bytes after the
+// damaged field. A frame with a body was an I-frame: it is rejected at once
+// instead of leaving the transmitter to its timeout. A bodiless one may have
+// been the answer to our own I-frame, which is then sent again right away.
+static void handleDamaged(t_link *link, uint8_t a, size_t size, int fragment)
+{
+    int known = a != 0;
+    int isInfo = size >= (known ? 2 : 4);
+
+    pthread_mutex_lock(&link->lock);
 
-        if (state == STOP)
+    if (isInfo && link->connected && (!known || ADDR_BASE(a) == link->peerAddr))
+    {
+        uint8_t channel = known ? ADDR_CH(a) : link->lastChannel;
+        if (sendRej(link, channel, fragment))
         {
-            alarmDisable();
-            return free(frameString), 0;
+            info("llread", "Damaged frame header, rejecting at once");
+            link->stats.n_errors++;
+            link->stats.n_fast_retx++;
         }
+    }
+    else if (!isInfo && link->outstanding && (!known || ADDR_BASE(a) == link->cmdAddr))
+    {
+        link->retryNow = TRUE;
+        pthread_cond_broadcast(&link->cond);
+    }
 
-        if (alarmEnabled)
-        {
-            alarmEnabled = FALSE;
+    pthread_mutex_unlock(&link->lock);
+}
+
+static void handleFrame(t_link *link, const t_decoded_frame *frame)
+{
+    switch (frame->kind)
+    {
+    case FRAME_I:
+        handleInfo(link, frame->a, frame->c, frame->data, frame->size, frame->valid, frame->fragment);
+        break;
+    case FRAME_S:
+    case FRAME_U:
+        handleSU(link, frame->a, frame->c);
+        break;
+    case FRAME_DAMAGED:
+        handleDamaged(link, frame->a, frame->skipped, frame->fragment);
+        break;
+    }
+}
+
+// Sends the acknowledgements whose piggyback delay expired.
+// Returns how many milliseconds the reader may block before the next one is due.
+static int flushOwedAcks(t_link *link)
+{
+    int timeout = POLL_MS;
 
-            if (alarmCount <= connectionParameters.nRetransmissions)
-            {
-                if (writeBytesSerialPort(frameString, BUF_SIZE) < 0)
-                    return free(frameString), spError("transmitFrame", FALSE);
+    pthread_mutex_lock(&link->lock);
+    for (int i = 0; i < MAX_CHANNELS; i++)
+    {
+        if (!link->ackOwed[i])
+            continue;
 
-                info("transmitFrame", "Retransmiting frame!");
-                alarm(connectionParameters.timeout);
-            }
+        double left = secondsUntil(link->ackDeadline[i]);
+        if (left <= 0)
+            sendAck(link, i);
+        else if (left * 1000 < timeout)
+            timeout = left * 1000 + 1;
+    }
+    pthread_mutex_unlock(&link->lock);
 
-            state = START;
+    return timeout;
+}
+
+static void *readerLoop(void *arg)
+{
+    t_link *link = arg;
+    t_transport *tp = link->tp;
+    uint8_t chunk[READ_CHUNK];
+
+    while (link->running)
+    {
+        int retv = tp->ops->read(tp, chunk, sizeof(chunk), flushOwedAcks(link));
+        if (retv < 0)
+            break;
+        captureBytes(link->capture, CAPTURE_READ, chunk, retv);
+
+        const uint8_t *bytes = chunk;
+        size_t size = retv;
+        t_decoded_frame frame;
+        TRACE_BEGIN(TR_DECODE);
+        while (frameDecode(&link->decoder, &bytes, &size, &frame))
+            handleFrame(link, &frame);
+        TRACE_END(TR_DECODE);
+    }
+
+    if (link->running)
+    {
+        // A peer that hangs up is not an error, whoever waits on it will time
+        // out, and neither is the end of the line once DISC went either way
+        pthread_mutex_lock(&link->lock);
+        if (!tp->closed && !link->closing)
+            spError("readerLoop", TRUE);
+        link->failed = TRUE;
+        pthread_cond_broadcast(&link->cond);
+        pthread_mutex_unlock(&link->lock);
+    }
+
+    return NULL;
+}
+
+////////////////////////////////////////////////
+// CONTROL FRAMES
+////////////////////////////////////////////////
+// Waits (forever) for the peer to send the expected U-frame
+static int receiveFrame(t_link *link, t_frame expected)
+{
+    int addr = expected.a == ADDR_SEND;
+    int index = uIndex(expected.c);
+
+    pthread_mutex_lock(&link->lock);
+    while (link->uSeen[addr][index] == 0 && !link->failed)
+        pthread_cond_wait(&link->cond, &link->lock);
+
+    int retv = link->failed ? -1 : 0;
+    if (retv == 0)
+        link->uSeen[addr][index]--;
+    pthread_mutex_unlock(&link->lock);
+
+    return retv;
+}
+
+// Sends a U-frame until the expected answer arrives or the retries run out
+static int transmitFrame(t_link *link, t_frame toSend, t_frame expected)
+{
+    int addr = expected.a == ADDR_SEND;
+    int index = uIndex(expected.c);
+
+    pthread_mutex_lock(&link->lock);
+
+    for (int try = 0; try <= link->params.nRetransmissions; try++)
+    {
+        if (try > 0)
+            logWarn("transmitFrame", "Retransmiting frame!");
+
+        if (writeFrame(link, toSend) < 0)
+            return pthread_mutex_unlock(&link->lock), spError("transmitFrame", FALSE);
+
+        struct timespec deadline = deadlineAfter(link->timeout);
+        while (link->uSeen[addr][index] == 0 && !link->failed)
+            if (pthread_cond_timedwait(&link->cond, &link->lock, &deadline) != 0)
+                break;
+
+        if (link->failed)
+            break;
+
+        if (link->uSeen[addr][index] > 0)
+        {
+            link->uSeen[addr][index]--;
+            return pthread_mutex_unlock(&link->lock), 0;
         }
+
+        logWarn("transmitFrame", "Alarm %d", try + 1);
     }
 
-    alarmDisable();
-    free(frameString);
+    pthread_mutex_unlock(&link->lock);
     return err("transmitFrame", "Transmition failure - timeout");
 }
 
 ////////////////////////////////////////////////
 // LLOPEN
 ////////////////////////////////////////////////
+static void freeLink(t_link *link)
+{
+    if (link->running)
+    {
+        link->running = FALSE;
+        pthread_join(link->reader, NULL);
+    }
+    captureClose(link->capture);
+
+    pthread_mutex_destroy(&link->lock);
+    pthread_mutex_destroy(&link->writeLock);
+    pthread_mutex_destroy(&link->sendLock);
+    pthread_cond_destroy(&link->cond);
+    free(link);
+}
+
+// Undoes what llopen did so far, the caller has nothing to llclose
+static int openFailed(t_link *link)
+{
+    t_transport *tp = link->tp;
+    freeLink(link);
+    ll = NULL;
+    if (tp != NULL)
+        transportClose(tp);
+    logFlush();
+    return -1;
+}
+
 int llopen(LinkLayer connection)
 {
-    gettimeofday(&stats.start, NULL);
+    t_link *link = calloc(1, sizeof(t_link));
+    if (link == NULL)
+        return err("llopen", "Couldn't allocate link");
 
-    struct timeval start;
+    gettimeofday(&link->stats.start, NULL);
 
-    memcpy(&connectionParameters, &connection, sizeof(connection));
+    struct timeval start;
 
-    if (openSerialPort(connectionParameters.serialPort,
-                       connectionParameters.baudRate) < 0)
-        return -1;
+    memcpy(&link->params, &connection, sizeof(connection));
+    link->cmdAddr = connection.role == LlTx ? ADDR_SEND : ADDR_RCV;
+    link->peerAddr = connection.role == LlTx ? ADDR_RCV : ADDR_SEND;
+    link->ackDelay = getConfig()->ackDelay;
+    link->timeout = getConfig()->timeout > 0 ? getConfig()->timeout : connection.timeout;
+    if (getConfig()->retries >= 0)
+        link->params.nRetransmissions = getConfig()->retries;
+    if (link->timeout != connection.timeout || link->params.nRetransmissions != connection.nRetransmissions)
+        logInfo("llopen", "Timeout %.3f s, %d retransmissions", link->timeout, link->params.nRetransmissions);
+    link->aggregate = getConfig()->aggregate;
+    metricsInit(&link->metrics, &connection);
+    frameDecoderInit(&link->decoder);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&link->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&link->lock, NULL);
+    pthread_mutex_init(&link->writeLock, NULL);
+    pthread_mutex_init(&link->sendLock, NULL);
+
+    ll = link;
+
+    link->tp = transportOpen(link->params.serialPort, link->params.baudRate, link->params.role);
+    if (link->tp == NULL)
+        return openFailed(link);
+    if (getConfig()->capture != NULL)
+        link->capture = captureOpen(getConfig()->capture, connection.role, connection.baudRate);
+
+    link->running = TRUE;
+    if (pthread_create(&link->reader, NULL, readerLoop, link) != 0)
+    {
+        link->running = FALSE;
+        return err("llopen", "Couldn't start reader thread"), openFailed(link);
+    }
 
-    switch (connectionParameters.role)
+    switch (link->params.role)
     {
     case LlTx:
         gettimeofday(&start, NULL);
 
-        if (transmitFrame(SET_Command, UA_Rx_Response))
-            return -1;
+        if (transmitFrame(link, SET_Command, UA_Rx_Response))
+            return openFailed(link);
 
-        stats.n_frames++;
+        link->stats.n_frames++;
 
         struct timeval end;
         gettimeofday(&end, NULL);
 
-        stats.time_send_control += TIME_DIFF(start, end);
+        link->stats.time_send_control += TIME_DIFF(start, end);
 
         info("llopen", "Transmiter Connected!");
         break;
     case LlRx:
-        if (receiveFrame(SET_Command))
-            return -1;
+        if (receiveFrame(link, SET_Command))
+            return openFailed(link);
 
-        stats.n_frames++;
-        stats.bytes_read += BUF_SIZE;
+        // I-frames are ignored until the transmitter has connected
+        link->connected = TRUE;
+        link->stats.n_frames++;
+        link->stats.bytes_read += BUF_SIZE;
 
-        if (writeFrameToSerialPort(UA_Rx_Response) < 0)
-            return spError("llopen", FALSE);
+        if (writeFrame(link, UA_Rx_Response) < 0)
+            return spError("llopen", FALSE), openFailed(link);
         info("llopen", "Receiver Connected!");
         break;
     }
 
+    pthread_mutex_lock(&link->lock);
+    link->connected = TRUE;
+    publishTelemetry(link);
+    pthread_mutex_unlock(&link->lock);
+
+    // Ahead of whatever the caller prints next
+    logFlush();
     return 0;
 }
 
-////////////////////////////////////////////////
-// LLWRITE
-////////////////////////////////////////////////
-int llwrite(const unsigned char *packet, int packetSize)
+// The reader thread ends when the line fails. A new one is started, on a new
+// connection if the peer hung up, so that llreset can bring the link back.
+static int restartReader(t_link *link)
 {
-    if (packet == NULL)
+    if (link->running)
+    {
+        link->running = FALSE;
+        pthread_join(link->reader, NULL);
+    }
+
+    if (link->tp->closed)
+    {
+        t_transport *tp = transportOpen(link->params.serialPort, link->params.baudRate, link->params.role);
+        if (tp == NULL)
+            return -1;
+        transportClose(link->tp);
+        link->tp = tp;
+    }
+    frameDecoderInit(&link->decoder);
+
+    pthread_mutex_lock(&link->lock);
+    link->failed = FALSE;
+    pthread_mutex_unlock(&link->lock);
+
+    link->running = TRUE;
+    if (pthread_create(&link->reader, NULL, readerLoop, link) != 0)
+    {
+        link->running = FALSE;
+        link->failed = TRUE;
+        return err("llreset", "Couldn't start reader thread");
+    }
+    return 0;
+}
+
+int llreset(void)
+{
+    t_link *link = ll;
+
+    if (link == NULL || link->params.role != LlTx)
+        return err("llreset", "Only an open transmitter can reconnect");
+
+    if (link->failed && restartReader(link) < 0)
         return -1;
 
-    t_frame_ctrl ctrl = frameNumber ? CTRL_INFO1 : CTRL_INFO0;
-    t_frame frame = newFrame(ADDR_SEND, ctrl, (uint8_t *)packet, packetSize);
+    // Packets held back for aggregation go to the old peer or nowhere
+    if (llflush() < 0)
+        info("llreset", "Dropped packets waiting for aggregation");
 
-    size_t stuffedSize = 0;
-    uint8_t *stuffedString = frameToString(&frame, &stuffedSize);
+    pthread_mutex_lock(&link->lock);
+    memset(link->ns, 0, sizeof(link->ns));
+    memset(link->nr, 0, sizeof(link->nr));
+    memset(link->rejSent, 0, sizeof(link->rejSent));
+    pthread_mutex_unlock(&link->lock);
 
-    t_state state = START;
-    (void)signal(SIGALRM, alarmHandler);
+    if (transmitFrame(link, SET_Command, UA_Rx_Response))
+        return -1;
 
+    info("llreset", "Transmiter Reconnected!");
+    return 0;
+}
+
+const t_metrics *llmetrics(void)
+{
+    return ll != NULL ? &ll->metrics : NULL;
+}
+
+int llclosing(void)
+{
+    t_link *link = ll;
+    return link == NULL || link->closing || link->failed;
+}
+
+////////////////////////////////////////////////
+// LLWRITE
+////////////////////////////////////////////////
+int llwrite(const unsigned char *packet, int packetSize)
+{
+    return llwriteChannel(CONTROL_CHANNEL, packet, packetSize);
+}
+
+// Sends one I-frame and waits for its acknowledgement. The caller holds sendLock.
+static int sendInfo(t_link *link, uint8_t channel, const uint8_t *packet, int packetSize, int aggregate)
+{
     struct timeval start;
     gettimeofday(&start, NULL);
+    double called = metricsNow();
 
-    if (writeBytesSerialPort(stuffedString, stuffedSize) < 0)
-        return free(stuffedString), spError("llwrite", FALSE);
+    t_frame_addr addr = ADDR_CHANNEL(link->cmdAddr, channel);
 
-    alarm(connectionParameters.timeout);
+    pthread_mutex_lock(&link->lock);
 
-    uint8_t receivedCtrl = 0;
-    while (state != STOP && alarmCount <= connectionParameters.nRetransmissions)
+    link->outstanding = TRUE;
+    link->outChannel = channel;
+
+    TRACE_BEGIN(TR_LLWRITE);
+    int tries = 0;
+    int stalled = FALSE;
+    int sent = FALSE;
+    while (tries <= link->params.nRetransmissions && !link->failed)
     {
-        uint8_t byte = 0;
-        int retv = readByteSerialPort(&byte);
+        if (sent)
+        {
+            TRACE_MARK(TR_RETRANSMIT);
+            publishTelemetry(link);
+        }
+        sent = TRUE;
 
-        if (retv < 0)
-            return free(stuffedString), spError("llwrite", FALSE);
+        // Rebuilt on every try so that it carries the current N(R)
+        t_frame_ctrl ctrl = INFO_CTRL(link->ns[channel], link->nr[channel]) | (aggregate ? INFO_AGG : 0);
+        t_frame frame = newFrame(addr, ctrl, (uint8_t *)packet, packetSize);
 
-        if (retv > 0)
+        if (link->ackOwed[channel])
         {
-            switch (state)
-            {
-            case START:
-                receivedCtrl = 0;
-                if (byte == FLAG)
-                    state = FLAG_RCV;
-                break;
-            case FLAG_RCV:
-                if (byte == FLAG)
-                    continue;
-                state = START;
-                if (byte == ADDR_SEND || byte == A_RCV)
-                    state = A_RCV;
-                break;
-            case A_RCV:
-                state = START;
-                if (byte == CTRL_RR0 || byte == CTRL_RR1 || byte == CTRL_REJ0 || byte == CTRL_REJ1)
-                {
-                    state = C_RCV;
-                    receivedCtrl = byte;
-                }
-                else if (byte == FLAG)
-                    state = FLAG_RCV;
-                break;
-            case C_RCV:
-                state = START;
-                if (byte == (CTRL_RR0 ^ ADDR_SEND) || byte == (CTRL_RR1 ^ ADDR_SEND) || byte == (CTRL_REJ0 ^ ADDR_SEND) || byte == (CTRL_REJ1 ^ ADDR_SEND))
-                    state = BCC_OK;
-                else if (byte == FLAG)
-                    state = FLAG_RCV;
-                break;
-            case BCC_OK:
-                state = START;
-                if (byte == FLAG)
-                    state = STOP;
-                break;
-            default:
-                state = START;
-            }
+            link->ackOwed[channel] = FALSE;
+            link->stats.n_piggyback++;
+        }
+
+        link->acked = link->rejected = FALSE;
+        link->paused = link->resumed = FALSE;
+        link->retryNow = FALSE;
+
+        // The reader must keep answering while a long frame is on the wire
+        pthread_mutex_unlock(&link->lock);
+        int written = writeFrame(link, frame);
+        pthread_mutex_lock(&link->lock);
+
+        if (written < 0)
+        {
+            link->outstanding = FALSE;
+            pthread_mutex_unlock(&link->lock);
+            return spError("llwrite", FALSE);
         }
 
-        if (state == STOP)
+        // An I-frame that arrived while this one was written is answered now,
+        // the next frame of ours may be far away
+        if (link->ackOwed[channel])
+            sendAck(link, channel);
+
+        double sentAt = metricsNow();
+        link->metrics.framesSent++;
+        link->metrics.payloadSent += packetSize;
+        link->metrics.stuffingSent += frame.bytesToStuff;
+        link->metrics.wireSent += written;
+
+        TRACE_BEGIN(TR_ACK_WAIT);
+        struct timespec deadline = deadlineAfter(link->timeout);
+        while (!link->acked && !link->rejected && !link->resumed && !link->retryNow && !link->failed)
+            if (pthread_cond_timedwait(&link->cond, &link->lock, &deadline) != 0)
+                break;
+        TRACE_END(TR_ACK_WAIT);
+
+        if (link->acked)
         {
-            if (receivedCtrl == CTRL_REJ0 || receivedCtrl == CTRL_REJ1)
-            {
-                alarmEnabled = TRUE;
-                alarmCount = 0;
-                stats.n_errors++;
-                info("llwrite", "Rejected, trying again...");
-            }
-
-            if (receivedCtrl == CTRL_RR0 || receivedCtrl == CTRL_RR1)
-            {
-                struct timeval end;
-                gettimeofday(&end, NULL);
-                stats.time_send_data += TIME_DIFF(start, end);
-
-                alarmDisable();
-                frameNumber = 1 - frameNumber;
-
-                stats.n_frames++;
-
-                return free(stuffedString), packetSize;
-            }
+            TRACE_END(TR_LLWRITE);
+            struct timeval end;
+            gettimeofday(&end, NULL);
+            link->stats.time_send_data += TIME_DIFF(start, end);
+
+            double now = metricsNow();
+            double rtt = (now - sentAt) * 1e6;
+            histRecord(&link->metrics.frameRtt, rtt);
+            histRecord(&link->metrics.packetLatency, (now - called) * 1e6);
+            link->metrics.payloadAcked += packetSize;
+            link->metrics.srtt += link->metrics.srtt > 0 ? (rtt - link->metrics.srtt) / 8 : rtt;
+
+            link->ns[channel] ^= 1;
+            link->outstanding = FALSE;
+            link->stats.n_frames++;
+            publishTelemetry(link);
+
+            pthread_mutex_unlock(&link->lock);
+            return packetSize;
         }
 
-        if (alarmEnabled)
+        if (link->rejected)
         {
-            alarmEnabled = FALSE;
+            tries = 0;
+            link->stats.n_errors++;
+            link->metrics.retxRej++;
+            logWarn("llwrite", "Rejected, trying again...");
+            continue;
+        }
 
-            if (alarmCount <= connectionParameters.nRetransmissions)
-            {
-                if (writeBytesSerialPort(stuffedString, stuffedSize) < 0)
-                    return free(stuffedString), spError("llwrite", FALSE);
+        if (link->resumed)
+        {
+            tries = 0;
+            link->metrics.retxRnr++;
+            info("llwrite", "Receiver ready, resuming");
+            continue;
+        }
 
-                alarm(connectionParameters.timeout);
-            }
+        if (link->retryNow)
+        {
+            link->stats.n_fast_retx++;
+            link->metrics.retxDamaged++;
+            logWarn("llwrite", "Answer arrived damaged, trying again...");
+        }
 
-            state = START;
+        // Still answering RNR: the retransmission is only a poll, not a retry
+        if (link->paused)
+        {
+            if (!stalled)
+                link->stats.n_rnr++;
+            stalled = TRUE;
+            tries = 0;
+            link->metrics.retxRnr++;
+            continue;
         }
+
+        if (!link->retryNow)
+            link->metrics.retxTimeout++;
+        tries++;
     }
 
-    alarmDisable();
-    free(stuffedString);
+    link->outstanding = FALSE;
+    pthread_mutex_unlock(&link->lock);
     return err("llwrite", "Transmition failure - timeout");
 }
 
+// Sends the packets held back for aggregation. The caller holds sendLock.
+static int flushPending(t_link *link)
+{
+    if (link->pendingCount == 0)
+        return 0;
+
+    int retv;
+    if (link->pendingCount == 1)
+        retv = sendInfo(link, link->pendingChannel, link->pending + AGG_HEADER,
+                        link->pendingSize - AGG_HEADER, FALSE);
+    else
+        retv = sendInfo(link, link->pendingChannel, link->pending, link->pendingSize, TRUE);
+
+    if (retv >= 0 && link->pendingCount > 1)
+        link->stats.n_aggregated += link->pendingCount;
+
+    link->pendingSize = 0;
+    link->pendingCount = 0;
+    return retv < 0 ? -1 : 0;
+}
+
+static void llwriteDone(t_link *link, uint8_t channel)
+{
+    pthread_mutex_lock(&link->lock);
+    link->sending[channel]--;
+    pthread_mutex_unlock(&link->lock);
+}
+
+int llwriteChannel(uint8_t channel, const unsigned char *packet, int packetSize)
+{
+    t_link *link = ll;
+
+    if (link == NULL || packet == NULL)
+        return -1;
+
+    if (channel >= MAX_CHANNELS || packetSize > MAX_PAYLOAD_SIZE)
+        return err("llwrite", "Invalid channel or packet size");
+
+    pthread_mutex_lock(&link->lock);
+    link->sending[channel]++;
+    pthread_mutex_unlock(&link->lock);
+    pthread_mutex_lock(&link->sendLock);
+
+    // The held packets go first when this one can't join them
+    if (link->pendingCount > 0 &&
+        (!link->aggregate || packetSize > AGG_PACKET_MAX || channel != link->pendingChannel ||
+         link->pendingSize + AGG_HEADER + packetSize > MAX_PAYLOAD_SIZE) &&
+        flushPending(link) < 0)
+    {
+        pthread_mutex_unlock(&link->sendLock);
+        llwriteDone(link, channel);
+        return err("llwrite", "Couldn't send the packets waiting for aggregation");
+    }
+
+    int retv = packetSize;
+    if (link->aggregate && packetSize <= AGG_PACKET_MAX)
+    {
+        uint8_t *record = link->pending + link->pendingSize;
+        record[0] = packetSize >> 8;
+        record[1] = packetSize & 0xFF;
+        memcpy(record + AGG_HEADER, packet, packetSize);
+        link->pendingSize += AGG_HEADER + packetSize;
+        link->pendingCount++;
+        link->pendingChannel = channel;
+    }
+    else
+    {
+        retv = sendInfo(link, channel, packet, packetSize, FALSE);
+    }
+
+    pthread_mutex_unlock(&link->sendLock);
+    llwriteDone(link, channel);
+    return retv;
+}
+
+int llflush(void)
+{
+    t_link *link = ll;
+
+    if (link == NULL)
+        return -1;
+
+    pthread_mutex_lock(&link->sendLock);
+    int retv = flushPending(link);
+    pthread_mutex_unlock(&link->sendLock);
+
+    return retv < 0 ? err("llflush", "Couldn't send the packets waiting for aggregation") : 0;
+}
+
 ////////////////////////////////////////////////
 // LLREAD
 ////////////////////////////////////////////////
 int llread(unsigned char *packet)
 {
+    return llreadChannel(packet, NULL);
+}
+
+int llreadChannel(unsigned char *packet, uint8_t *channel)
+{
+    t_link *link = ll;
+
     if (packet == NULL)
         return err("llread", "Packet in llread is null!");
 
-    t_state state = START;
+    if (link == NULL)
+        return err("llread", "Link is not open!");
+
+    // The peer may be waiting for a held packet before it answers
+    if (link->aggregate && llflush() < 0)
+        return -1;
 
-    t_frame frame;
-    frame.data = packet;
-    frame.dataSize = MAX_PAYLOAD_SIZE;
+    pthread_mutex_lock(&link->lock);
+    link->readers++;
+    TRACE_BEGIN(TR_LLREAD_WAIT);
+    while (link->queueCount == 0 && !link->failed && !link->closing)
+        pthread_cond_wait(&link->cond, &link->lock);
+    TRACE_END(TR_LLREAD_WAIT);
 
-    int idx = 0;
-    while (state != STOP)
+    link->readers--;
+    if (link->queueCount == 0)
     {
-        uint8_t buf = 0;
-        int retv = readByteSerialPort(&buf);
+        pthread_cond_broadcast(&link->cond);
+        return pthread_mutex_unlock(&link->lock), -1;
+    }
 
-        if (retv < 0)
-            return spError("llread", TRUE);
+    t_rx_packet *received = &link->queue[link->queueHead];
+    int size = received->size;
+    if (channel != NULL)
+        *channel = received->channel;
 
-        if (retv > 0)
+    // An aggregate frame is handed out one record per call
+    if (received->aggregate)
+    {
+        uint8_t *record = received->data + received->offset;
+        size_t left = received->size - received->offset;
+        size = left >= AGG_HEADER ? (record[0] << 8 | record[1]) : 0;
+        if (left < AGG_HEADER || (size_t)size > left - AGG_HEADER)
         {
-            switch (state)
-            {
-            case START:
-                frame.c = 0;
-                if (buf == FLAG)
-                    state = FLAG_RCV;
-                break;
-            case FLAG_RCV:
-                if (buf == FLAG)
-                    continue;
-                state = START;
-                if (buf == ADDR_SEND)
-                {
-                    frame.a = buf;
-                    state = A_RCV;
-                }
-                break;
-            case A_RCV:
-                state = START;
-                if (buf == CTRL_INFO0 || buf == CTRL_INFO1)
-                {
-                    state = C_RCV;
-                    frame.c = buf;
-                }
-                else if (buf == FLAG)
-                    state = FLAG_RCV;
-                break;
-            case C_RCV:
-                state = START;
-                if (buf == (frame.c ^ ADDR_SEND))
-                {
-                    frame.bcc1 = frame.c ^ ADDR_SEND;
-                    state = DATA_RCV;
-                }
-                else if (buf == FLAG)
-                    state = FLAG_RCV;
-                break;
-            case DATA_RCV:
-                if (buf == FLAG)
-                {
-                    frame.dataSize = idx;
-
-                    if (frameDestuff(&frame))
-                        return err("llread", "Destuff failed");
-
-                    uint8_t bcc2 = 0x00;
-                    for (size_t i = 0; i < frame.dataSize; i++)
-                        bcc2 ^= frame.data[i];
-
-                    t_frame response;
-
-                    if (bcc2 == frame.bcc2)
-                    {
-                        response = (frame.c == CTRL_INFO0) ? RR1_Command : RR0_Command;
-                    }
-                    else
-                    {
-                        response = (frame.c == CTRL_INFO0) ? REJ0_Command : REJ1_Command;
-                    }
-
-                    state = START;
-                    idx = 0;
-
-                    if (writeFrameToSerialPort(response) < 0)
-                        return spError("llread", FALSE);
-
-                    if (response.c == CTRL_REJ0 || response.c == CTRL_REJ1)
-                    {
-                        info("llread", "Invalid frame, trying again...");
-                        stats.n_errors++;
-                        continue;
-                    }
-
-                    if ((frameNumber == 0 && frame.c == CTRL_INFO0) || (frameNumber == 1 && frame.c == CTRL_INFO1))
-                    {
-                        frameNumber = 1 - frameNumber;
-
-                        stats.bytes_read += frame.dataSize + 6;
-                        stats.n_frames++;
-
-                        return frame.dataSize;
-                    }
-
-                    info("llread", "Received duplicate frame");
-                    continue;
-                }
-
-                if (idx > MAX_PAYLOAD_SIZE)
-                {
-                    info("llread", "Payload is too big! Returning to start");
-                    state = START;
-                    idx = 0;
-                    continue;
-                }
-
-                packet[idx++] = buf;
-
-                break;
-            default:
-                state = START;
-            }
+            received->offset = received->size;
+            size = -1;
+            info("llread", "Malformed aggregate frame");
+        }
+        else
+        {
+            memcpy(packet, record + AGG_HEADER, size);
+            received->offset += AGG_HEADER + size;
+            link->metrics.payloadReceived += size;
         }
+
+        if (received->offset < received->size)
+            return pthread_mutex_unlock(&link->lock), size;
+    }
+    else
+    {
+        memcpy(packet, received->data, received->size);
+        link->metrics.payloadReceived += size;
     }
 
-    return -1;
+    link->queueHead = (link->queueHead + 1) % RX_QUEUE_LEN;
+    link->queueCount--;
+    sendReady(link);
+    publishTelemetry(link);
+
+    pthread_mutex_unlock(&link->lock);
+    return size;
 }
 
 ////////////////////////////////////////////////
@@ -637,14 +1217,33 @@ int llread(unsigned char *packet)
 ////////////////////////////////////////////////
 int llclose(int showStatistics)
 {
+    t_link *link = ll;
     struct timeval start;
 
-    switch (connectionParameters.role)
+    if (link == NULL)
+        return -1;
+
+    if (llflush() < 0)
+        info("llclose", "Dropped packets waiting for aggregation");
+
+    // Wake up threads still blocked in llread
+    pthread_mutex_lock(&link->lock);
+    link->closing = TRUE;
+    pthread_cond_broadcast(&link->cond);
+    publishTelemetry(link);
+    pthread_mutex_unlock(&link->lock);
+
+    t_statistics stats = link->stats;
+
+    switch (link->params.role)
     {
     case LlTx:
+        if (link->tp == NULL)
+            break;
+
         gettimeofday(&start, NULL);
 
-        if (transmitFrame(DISC_Tx_Command, DISC_Rx_Command))
+        if (transmitFrame(link, DISC_Tx_Command, DISC_Rx_Command))
             break;
 
         struct timeval end;
@@ -652,7 +1251,7 @@ int llclose(int showStatistics)
 
         stats.n_frames++;
 
-        if (writeFrameToSerialPort(UA_Tx_Response) < 0)
+        if (writeFrame(link, UA_Tx_Response) < 0)
         {
             spError("llclose", FALSE);
             break;
@@ -665,13 +1264,16 @@ int llclose(int showStatistics)
         break;
 
     case LlRx:
-        if (receiveFrame(DISC_Tx_Command))
+        if (link->tp == NULL)
+            break;
+
+        if (receiveFrame(link, DISC_Tx_Command))
             break;
 
         stats.n_frames++;
         stats.bytes_read += BUF_SIZE;
 
-        if (transmitFrame(DISC_Rx_Command, UA_Tx_Response))
+        if (transmitFrame(link, DISC_Rx_Command, UA_Tx_Response))
             break;
 
         stats.n_frames++;
@@ -681,53 +1283,89 @@ int llclose(int showStatistics)
         break;
     }
 
+    // The statistics are printed right away, the log goes first
+    logFlush();
     printf("\n");
 
+    t_metrics *m = &link->metrics;
+
     if (showStatistics)
     {
-        if (connectionParameters.role == LlRx)
-        {
-            struct timeval end;
-            gettimeofday(&end, NULL);
+        struct timeval end;
+        gettimeofday(&end, NULL);
+        double totalTime = TIME_DIFF(stats.start, end);
 
-            time_t totalTime = TIME_DIFF(stats.start, end);
+        if (link->params.role == LlRx)
+        {
             printf("Showing link-layer protocol statistics\n"
                    "  - Frames:\n"
-                   "    • Number of (unstuffed) bytes received: %ld\n"
-                   "    • Number of accepted frames: %ld\n"
-                   "    • Number of error frames: %ld\n"
-                   "    • Average size of frame: %ld\n"
+                   "    • Number of (unstuffed) bytes received: %zu\n"
+                   "    • Number of accepted frames: %zu\n"
+                   "    • Number of error frames: %zu\n"
+                   "    • Average payload of an I-frame: %.1f bytes\n"
                    "  - Efficiency:\n"
                    "    • Reception velocity (bits/s): %.2f\n"
-                   "    • Overall time taken: %ld seconds\n",
+                   "    • Overall time taken: %.3f seconds\n",
                    stats.bytes_read,
                    stats.n_frames,
                    stats.n_errors,
-                   stats.bytes_read / stats.n_frames,
-                   stats.bytes_read * 8.0 / totalTime,
+                   m->framesReceived > 0 ? (double)m->payloadReceived / m->framesReceived : 0,
+                   totalTime > 0 ? stats.bytes_read * 8.0 / totalTime : 0,
                    totalTime);
         }
         else
         {
+            size_t acked = m->packetLatency.count;
             printf("Showing link-layer protocol statistics\n"
                    "  - Frames:\n"
-                   "    • Number of (unstuffed) bytes received: %ld\n"
-                   "    • Number of accepted frames: %ld\n"
-                   "    • Number of error frames: %ld\n"
-                   "    • Average size of frame: %ld\n"
+                   "    • Number of payload bytes acknowledged: %" PRIu64 "\n"
+                   "    • Number of accepted frames: %zu\n"
+                   "    • Number of error frames: %zu\n"
+                   "    • Average payload of an I-frame: %.1f bytes\n"
                    "  - Efficiency:\n"
                    "    • Total time taken while sending and receving control frames: %f seconds\n"
                    "    • Total time taken while sending and receving data frames: %f seconds\n"
-                   "    • Average time taken to send a frame: %f seconds\n",
-                   stats.bytes_read,
+                   "    • Average time taken to send a frame: %f seconds\n"
+                   "    • Frame round trip: median %" PRIu64 " us, 99th percentile %" PRIu64 " us\n",
+                   m->payloadAcked,
                    stats.n_frames,
                    stats.n_errors,
-                   stats.bytes_read / stats.n_frames,
+                   acked > 0 ? (double)m->payloadAcked / acked : 0,
                    stats.time_send_control,
                    stats.time_send_data,
-                   (stats.time_send_data + stats.time_send_control) / stats.n_frames);
+                   stats.n_frames > 0 ? (stats.time_send_data + stats.time_send_control) / stats.n_frames : 0,
+                   histPercentile(&m->frameRtt, 50),
+                   histPercentile(&m->frameRtt, 99));
+
+            if (m->retxTimeout + m->retxRej + m->retxDamaged > 0)
+                printf("    • Retransmissions: %zu after a timeout, %zu after REJ, %zu after a damaged answer\n",
+                       m->retxTimeout, m->retxRej, m->retxDamaged);
         }
+
+        if (stats.n_rnr > 0)
+            printf("    • Receiver not ready (RNR) episodes: %zu\n", stats.n_rnr);
+        if (stats.n_piggyback > 0)
+            printf("    • Acknowledgements piggybacked on I-frames: %zu\n", stats.n_piggyback);
+        if (stats.n_fast_retx > 0)
+            printf("    • Damaged headers answered without waiting for the timeout: %zu\n", stats.n_fast_retx);
+        if (stats.n_aggregated > 0)
+            printf("    • Packets sent in shared I-frames: %zu\n", stats.n_aggregated);
     }
 
-    return closeSerialPort();
+    const char *metricsFile = getConfig()->metricsFile;
+    if (metricsFile != NULL && metricsExport(metricsFile, m, &stats) == 0)
+        printf("Link metrics written to '%s'\n", metricsFile);
+
+    pthread_mutex_lock(&link->lock);
+    while (link->readers > 0)
+        pthread_cond_wait(&link->cond, &link->lock);
+    pthread_mutex_unlock(&link->lock);
+
+    t_transport *tp = link->tp;
+    freeLink(link);
+    ll = NULL;
+
+    int retv = transportClose(tp);
+    logFlush();
+    return retv;
 }
@@ -0,0 +1,85 @@
+// Analytic link model, see link_model.h
+
+#include "link_model.h"
+
+double modelPower(double x, double n)
+{
+    // Square and multiply
+    double result = 1;
+    for (unsigned long e = n > 0 ? (unsigned long)n : 0; e > 0; e >>= 1, x *= x)
+        if (e & 1)
+            result *= x;
+    return result;
+}
+
+static double frameBytes(const t_line *line, size_t payload)
+{
+    return payload * (1 + line->stuffing) + MODEL_FRAME_OVERHEAD;
+}
+
+double modelFrameTime(const t_line *line, size_t payload)
+{
+    return frameBytes(line, payload) * MODEL_BITS_PER_BYTE / line->baudRate;
+}
+
+double modelAnswerTime(const t_line *line)
+{
+    return (double)MODEL_ANSWER_SIZE * MODEL_BITS_PER_BYTE / line->baudRate;
+}
+
+double modelFrameError(const t_line *line, size_t payload)
+{
+    double bits = 8 * (frameBytes(line, payload) + MODEL_ANSWER_SIZE);
+    return 1 - modelPower(1 - line->ber, bits + 0.5);
+}
+
+double modelCycle(const t_line *line, size_t payload)
+{
+    return 1 + (modelAnswerTime(line) + 2 * line->prop) / modelFrameTime(line, payload);
+}
+
+double modelEfficiency(const t_line *line, size_t payload, t_arq arq, int window)
+{
+    if (line->baudRate <= 0 || payload == 0)
+        return 0;
+
+    double p = modelFrameError(line, payload);
+    double k = modelCycle(line, payload);
+    double w = window > 1 ? window : 1;
+    double u;
+
+    switch (arq)
+    {
+    case ARQ_GO_BACK_N:
+        u = w >= k ? (1 - p) / (1 + (k - 1) * p) : w * (1 - p) / (k * (1 - p + w * p));
+        break;
+    case ARQ_SELECTIVE_REPEAT:
+        u = w >= k ? 1 - p : w * (1 - p) / k;
+        break;
+    default:
+        u = (1 - p) / k;
+    }
+
+    return 8.0 / MODEL_BITS_PER_BYTE * payload / frameBytes(line, payload) * u;
+}
+
+double modelBer(double fer, size_t payload, double stuffing)
+{
+    if (fer <= 0)
+        return 0;
+    if (fer >= 1)
+        return 0.5;
+
+    // The error rate grows with the bit error rate, so bisect
+    t_line line = {.baudRate = 1, .stuffing = stuffing};
+    double low = 0, high = 0.5;
+    for (int i = 0; i < 60; i++)
+    {
+        line.ber = (low + high) / 2;
+        if (modelFrameError(&line, payload) < fer)
+            low = line.ber;
+        else
+            high = line.ber;
+    }
+    return (low + high) / 2;
+}
@@ -0,0 +1,290 @@
+// Asynchronous leveled logger, see log.h
+
+#include "log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_RING 1024       // Messages queued, a power of two
+#define LOG_LINE 200        // Longer messages are cut
+#define LOG_FUNC 32
+#define LOG_BURST 5         // Repeats written per LOG_WINDOW
+#define LOG_WINDOW 1.0      // Seconds
+#define LOG_KEYS 64         // Messages rate limited at the same time
+#define IDLE_WAIT_MS 100
+
+typedef struct s_log_entry
+{
+    uint64_t    seq;        // Bounded MPMC queue cell: pos when free, pos + 1 when full
+    t_log_level level;
+    uint64_t    key;
+    double      time;
+    char        func[LOG_FUNC];
+    char        text[LOG_LINE];
+}   t_log_entry;
+
+// Rate limiting state of one message, only touched by the consumer
+typedef struct s_log_key
+{
+    uint64_t    key;
+    double      window;     // Start of the current window
+    size_t      count;      // Written in this window
+    size_t      suppressed;
+    char        func[LOG_FUNC];
+    char        text[LOG_LINE];
+}   t_log_key;
+
+static t_log_entry ring[LOG_RING];
+static uint64_t head;       // Next cell for producers
+static uint64_t tail;       // Next cell for the consumer
+
+static t_log_key keys[LOG_KEYS];
+static size_t dropped;
+
+static t_log_level level = LOG_INFO;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drainLock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t wake;
+static int waiting;
+static int started;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+////////////////////////////////////////////////
+// CONSUMER
+////////////////////////////////////////////////
+static void writeLine(const char *func, const char *text)
+{
+    if (func[0] != '\0')
+        printf("[%s] %s\n", func, text);
+    else
+        printf("%s\n", text);
+}
+
+static void reportSuppressed(t_log_key *k)
+{
+    if (k->suppressed == 0)
+        return;
+
+    char line[LOG_LINE + 64];
+    snprintf(line, sizeof(line), "suppressed %zu messages, the last: %s", k->suppressed, k->text);
+    writeLine(k->func, line);
+    k->suppressed = 0;
+}
+
+// Repeats past LOG_BURST in a window are only counted, the last one of them
+// is written with the count once the window is over (see expireKeys)
+static void emit(const t_log_entry *e)
+{
+    t_log_key *k = &keys[e->key % LOG_KEYS];
+    if (k->key != e->key)
+    {
+        reportSuppressed(k);
+        memset(k, 0, sizeof(*k));
+        k->key = e->key;
+    }
+
+    if (e->time - k->window >= LOG_WINDOW)
+    {
+        reportSuppressed(k);
+        k->window = e->time;
+        k->count = 0;
+    }
+
+    if (k->count < LOG_BURST)
+    {
+        k->count++;
+        writeLine(e->func, e->text);
+        return;
+    }
+
+    k->suppressed++;
+    memcpy(k->func, e->func, LOG_FUNC);
+    memcpy(k->text, e->text, LOG_LINE);
+}
+
+// Reports the keys whose window closed with messages held back, so they show
+// up even when the message isn't repeated afterwards
+static void expireKeys(double time)
+{
+    for (size_t i = 0; i < LOG_KEYS; i++)
+        if (keys[i].suppressed > 0 && time - keys[i].window >= LOG_WINDOW)
+        {
+            reportSuppressed(&keys[i]);
+            fflush(stdout);
+        }
+}
+
+// Writes the queued messages, returns how many. Only one consumer at a time.
+static size_t drain(void)
+{
+    size_t n = 0;
+    pthread_mutex_lock(&drainLock);
+    while (1)
+    {
+        t_log_entry *e = &ring[tail % LOG_RING];
+        if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+
+        emit(e);
+        __atomic_store_n(&e->seq, tail + LOG_RING, __ATOMIC_RELEASE);
+        tail++;
+        n++;
+    }
+
+    size_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+    if (lost > 0)
+        printf("[log] %zu messages dropped, the log couldn't keep up\n", lost);
+    if (n > 0 || lost > 0)
+        fflush(stdout);
+    expireKeys(now());
+    pthread_mutex_unlock(&drainLock);
+    return n;
+}
+
+static void *drainLoop(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        if (drain() > 0)
+            continue;
+
+        // Producers post when they see the flag, the timeout covers a race
+        __atomic_store_n(&waiting, 1, __ATOMIC_SEQ_CST);
+        if (drain() > 0)
+            continue;
+
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_nsec += IDLE_WAIT_MS * 1000000L;
+        t.tv_sec += t.tv_nsec / 1000000000L;
+        t.tv_nsec %= 1000000000L;
+        while (sem_timedwait(&wake, &t) < 0 && errno == EINTR)
+            ;
+    }
+    return NULL;
+}
+
+void logFlush(void)
+{
+    drain();
+
+    pthread_mutex_lock(&drainLock);
+    for (size_t i = 0; i < LOG_KEYS; i++)
+        reportSuppressed(&keys[i]);
+    fflush(stdout);
+    pthread_mutex_unlock(&drainLock);
+}
+
+static void start(void)
+{
+    const char *name = getenv("LL_LOG");
+    static const char *const names[] = {"debug", "info", "warn", "error", "off"};
+    for (int i = LOG_DEBUG; name != NULL && i <= LOG_OFF; i++)
+        if (strcmp(name, names[i]) == 0)
+            level = i;
+
+    for (uint64_t i = 0; i < LOG_RING; i++)
+        ring[i].seq = i;
+
+    // Without the thread messages are written right away
+    pthread_t thread;
+    sem_init(&wake, 0, 0);
+    if (pthread_create(&thread, NULL, drainLoop, NULL) == 0)
+    {
+        pthread_detach(thread);
+        started = 1;
+    }
+    atexit(logFlush);
+}
+
+////////////////////////////////////////////////
+// PRODUCERS
+////////////////////////////////////////////////
+// Claims a free cell, or returns NULL when the message is filtered out or the
+// ring is full, in which case it's dropped instead of waiting
+static t_log_entry *claim(t_log_level lvl, uint64_t *pos)
+{
+    pthread_once(&once, start);
+    if (lvl < level)
+        return NULL;
+
+    *pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    while (1)
+    {
+        t_log_entry *e = &ring[*pos % LOG_RING];
+        int64_t diff = (int64_t)__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) - (int64_t)*pos;
+        if (diff == 0 && __atomic_compare_exchange_n(&head, pos, *pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return e;
+        if (diff < 0)
+        {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        if (diff > 0)
+            *pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    }
+}
+
+static void publish(t_log_entry *e, uint64_t pos, t_log_level lvl, const char *func, uint64_t key)
+{
+    e->level = lvl;
+    e->key = key;
+    e->time = now();
+    snprintf(e->func, sizeof(e->func), "%s", func != NULL ? func : "");
+    __atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (!started)
+        drain();
+    else if (__atomic_exchange_n(&waiting, 0, __ATOMIC_SEQ_CST))
+        sem_post(&wake);
+}
+
+void logWrite(t_log_level lvl, const char *func, const char *fmt, ...)
+{
+    uint64_t pos;
+    t_log_entry *e = claim(lvl, &pos);
+    if (e == NULL)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(e->text, sizeof(e->text), fmt, args);
+    va_end(args);
+    publish(e, pos, lvl, func, (uintptr_t)fmt);
+}
+
+// FNV-1a of the function name and the text
+static uint64_t hashText(const char *func, const char *msg)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *p = func != NULL ? func : ""; *p != '\0'; p++)
+        h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    for (const char *p = msg; *p != '\0'; p++)
+        h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    return h;
+}
+
+void logText(t_log_level lvl, const char *func, const char *msg)
+{
+    uint64_t pos;
+    t_log_entry *e = claim(lvl, &pos);
+    if (e == NULL)
+        return;
+
+    snprintf(e->text, sizeof(e->text), "%s", msg);
+    publish(e, pos, lvl, func, hashText(func, msg));
+}
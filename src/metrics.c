@@ -0,0 +1,220 @@
+// Link metrics: latency histograms and JSON / CSV export
+
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SUB_COUNT (1 << HIST_SUB_BITS)
+#define HALF_COUNT (SUB_COUNT / 2)
+
+////////////////////////////////////////////////
+// HISTOGRAM
+////////////////////////////////////////////////
+static size_t bucketOf(uint64_t value)
+{
+    if (value < SUB_COUNT)
+        return value;
+
+    // Keep the top HIST_SUB_BITS bits of the value
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS + 1;
+    return SUB_COUNT + (shift - 1) * HALF_COUNT + ((value >> shift) - HALF_COUNT);
+}
+
+static uint64_t bucketTop(size_t bucket)
+{
+    if (bucket < SUB_COUNT)
+        return bucket;
+
+    int shift = (bucket - SUB_COUNT) / HALF_COUNT + 1;
+    uint64_t mantissa = (bucket - SUB_COUNT) % HALF_COUNT + HALF_COUNT;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void histRecord(t_histogram *h, uint64_t value)
+{
+    h->counts[bucketOf(value)]++;
+    if (h->count == 0 || value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+    h->count++;
+    h->sum += value;
+}
+
+uint64_t histPercentile(const t_histogram *h, double p)
+{
+    if (h->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+            return bucketTop(i) < h->max ? bucketTop(i) : h->max;
+    }
+    return h->max;
+}
+
+double histMean(const t_histogram *h)
+{
+    return h->count > 0 ? h->sum / h->count : 0;
+}
+
+////////////////////////////////////////////////
+// METRICS
+////////////////////////////////////////////////
+double metricsNow(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void metricsInit(t_metrics *m, const LinkLayer *params)
+{
+    memset(m, 0, sizeof(*m));
+    m->role = params->role;
+    m->baudRate = params->baudRate;
+    m->start = metricsNow();
+}
+
+// Values shared by both formats, in export order
+typedef struct s_summary
+{
+    double      elapsed;
+    uint64_t    payload;    // Delivered: acked when sending, read when receiving
+    double      goodput;    // bits/s
+    double      efficiency; // goodput / line rate
+    double      stuffing;   // Escape bytes per payload byte
+    double      overhead;   // Wire bytes per payload byte, minus one
+}   t_summary;
+
+static t_summary summarize(const t_metrics *m)
+{
+    t_summary s = {0};
+    s.elapsed = metricsNow() - m->start;
+    s.payload = m->role == LlTx ? m->payloadAcked : m->payloadReceived;
+    s.goodput = s.elapsed > 0 ? s.payload * 8.0 / s.elapsed : 0;
+    s.efficiency = m->baudRate > 0 ? s.goodput / m->baudRate : 0;
+    if (m->payloadSent > 0)
+    {
+        s.stuffing = (double)m->stuffingSent / m->payloadSent;
+        s.overhead = (double)m->wireSent / m->payloadSent - 1;
+    }
+    return s;
+}
+
+static const double percentiles[] = {50, 90, 99, 99.9};
+static const char *const percentileNames[] = {"p50", "p90", "p99", "p999"};
+#define N_PERCENTILES (sizeof(percentiles) / sizeof(percentiles[0]))
+
+static void jsonHistogram(FILE *file, const char *name, const t_histogram *h, const char *end)
+{
+    fprintf(file, "  \"%s\": {\"count\": %" PRIu64 ", \"min\": %" PRIu64 ", \"mean\": %.1f", name,
+            h->count, h->min, histMean(h));
+    for (size_t i = 0; i < N_PERCENTILES; i++)
+        fprintf(file, ", \"%s\": %" PRIu64, percentileNames[i], histPercentile(h, percentiles[i]));
+    fprintf(file, ", \"max\": %" PRIu64 "}%s\n", h->max, end);
+}
+
+static int exportJson(FILE *file, const t_metrics *m, const t_statistics *stats)
+{
+    t_summary s = summarize(m);
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"role\": \"%s\",\n", m->role == LlTx ? "tx" : "rx");
+    fprintf(file, "  \"elapsed_s\": %.6f,\n", s.elapsed);
+    fprintf(file, "  \"frames\": {\"sent\": %zu, \"received\": %zu, \"errors\": %zu},\n",
+            m->framesSent, m->framesReceived, stats->n_errors);
+    fprintf(file, "  \"retransmits\": {\"timeout\": %zu, \"rej\": %zu, \"damaged\": %zu, \"rnr\": %zu},\n",
+            m->retxTimeout, m->retxRej, m->retxDamaged, m->retxRnr);
+    fprintf(file, "  \"payload_bytes\": %" PRIu64 ",\n", s.payload);
+    fprintf(file, "  \"stuffing_ratio\": %.6f,\n", s.stuffing);
+    fprintf(file, "  \"overhead_ratio\": %.6f,\n", s.overhead);
+    fprintf(file, "  \"goodput_bps\": %.1f,\n", s.goodput);
+    fprintf(file, "  \"line_rate_bps\": %d,\n", m->baudRate);
+    fprintf(file, "  \"efficiency\": %.6f,\n", s.efficiency);
+    jsonHistogram(file, "frame_rtt_us", &m->frameRtt, ",");
+    jsonHistogram(file, "packet_latency_us", &m->packetLatency, "");
+    fprintf(file, "}\n");
+    return 0;
+}
+
+static void csvHistogramHeader(FILE *file, const char *name)
+{
+    fprintf(file, ",%s_count,%s_min,%s_mean", name, name, name);
+    for (size_t i = 0; i < N_PERCENTILES; i++)
+        fprintf(file, ",%s_%s", name, percentileNames[i]);
+    fprintf(file, ",%s_max", name);
+}
+
+static void csvHistogram(FILE *file, const t_histogram *h)
+{
+    fprintf(file, ",%" PRIu64 ",%" PRIu64 ",%.1f", h->count, h->min, histMean(h));
+    for (size_t i = 0; i < N_PERCENTILES; i++)
+        fprintf(file, ",%" PRIu64, histPercentile(h, percentiles[i]));
+    fprintf(file, ",%" PRIu64, h->max);
+}
+
+static int exportCsv(FILE *file, const t_metrics *m, const t_statistics *stats)
+{
+    t_summary s = summarize(m);
+
+    if (ftell(file) == 0)
+    {
+        fprintf(file, "time,role,elapsed_s,frames_sent,frames_received,errors,"
+                      "retx_timeout,retx_rej,retx_damaged,retx_rnr,payload_bytes,stuffing_ratio,"
+                      "overhead_ratio,goodput_bps,line_rate_bps,efficiency");
+        csvHistogramHeader(file, "frame_rtt_us");
+        csvHistogramHeader(file, "packet_latency_us");
+        fprintf(file, "\n");
+    }
+
+    fprintf(file, "%ld,%s,%.6f,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%" PRIu64 ",%.6f,%.6f,%.1f,%d,%.6f",
+            (long)time(NULL), m->role == LlTx ? "tx" : "rx", s.elapsed, m->framesSent, m->framesReceived,
+            stats->n_errors, m->retxTimeout, m->retxRej, m->retxDamaged, m->retxRnr,
+            s.payload, s.stuffing, s.overhead, s.goodput, m->baudRate, s.efficiency);
+    csvHistogram(file, &m->frameRtt);
+    csvHistogram(file, &m->packetLatency);
+    fprintf(file, "\n");
+    return 0;
+}
+
+int metricsExport(const char *path, const t_metrics *m, const t_statistics *stats)
+{
+    size_t len = strlen(path);
+    int csv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+
+    FILE *file = fopen(path, csv ? "a" : "w");
+    if (file == NULL)
+        return err("metricsExport", "Couldn't open the metrics file");
+
+    int retv = csv ? exportCsv(file, m, stats) : exportJson(file, m, stats);
+    return fclose(file) != 0 ? -1 : retv;
+}
+
+double metricsColumn(const char *header, const char *row, const char *name)
+{
+    size_t len = strlen(name);
+    const char *h = header, *v = row;
+    while (h != NULL && v != NULL)
+    {
+        if (strncmp(h, name, len) == 0 && (h[len] == ',' || h[len] == '\n' || h[len] == '\0'))
+            return atof(v);
+        h = strchr(h, ',');
+        v = strchr(v, ',');
+        h = h != NULL ? h + 1 : NULL;
+        v = v != NULL ? v + 1 : NULL;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Logical channel scheduler
+
+#include "mux.h"
+
+#include <string.h>
+
+#include "utils.h"
+
+#define PRIO_CONTROL 255
+
+void muxInit(t_mux *mux, t_mux_policy policy)
+{
+    memset(mux, 0, sizeof(*mux));
+    mux->policy = policy;
+    mux->channels[CONTROL_CHANNEL].priority = PRIO_CONTROL;
+    mux->last = MAX_CHANNELS - 1;
+}
+
+void muxSetPriority(t_mux *mux, uint8_t channel, uint8_t priority)
+{
+    if (mux != NULL && channel < MAX_CHANNELS)
+        mux->channels[channel].priority = priority;
+}
+
+int muxEnqueue(t_mux *mux, uint8_t channel, const uint8_t *data, size_t size)
+{
+    if (mux == NULL || data == NULL || channel >= MAX_CHANNELS)
+        return err("muxEnqueue", "Invalid arguments");
+
+    t_mux_packet *packet = malloc(sizeof(t_mux_packet));
+    if (packet == NULL)
+        return err("muxEnqueue", "Couldn't allocate packet");
+
+    packet->data = malloc(size);
+    if (packet->data == NULL)
+        return free(packet), err("muxEnqueue", "Couldn't allocate packet data");
+
+    memcpy(packet->data, data, size);
+    packet->size = size;
+    packet->next = NULL;
+
+    t_mux_channel *ch = &mux->channels[channel];
+    if (ch->tail == NULL)
+        ch->head = packet;
+    else
+        ch->tail->next = packet;
+    ch->tail = packet;
+    ch->queued++;
+
+    return 0;
+}
+
+size_t muxQueued(t_mux *mux, uint8_t channel)
+{
+    if (mux == NULL || channel >= MAX_CHANNELS)
+        return 0;
+    return mux->channels[channel].queued;
+}
+
+// Pick the next channel to serve, starting after the last one served so
+// that channels with the same priority take turns.
+static int muxPick(t_mux *mux)
+{
+    int best = -1;
+
+    for (int i = 1; i <= MAX_CHANNELS; i++)
+    {
+        uint8_t ch = (mux->last + i) % MAX_CHANNELS;
+        if (mux->channels[ch].queued == 0)
+            continue;
+
+        if (mux->policy == MUX_RR)
+            return ch;
+
+        if (best < 0 || mux->channels[ch].priority > mux->channels[best].priority)
+            best = ch;
+    }
+
+    return best;
+}
+
+// Send the head packet of the scheduled channel.
+// Returns the channel served, -1 on error or if nothing is queued.
+int muxSendNext(t_mux *mux)
+{
+    if (mux == NULL)
+        return -1;
+
+    int ch = muxPick(mux);
+    if (ch < 0)
+        return -1;
+
+    t_mux_channel *channel = &mux->channels[ch];
+    t_mux_packet *packet = channel->head;
+
+    if (llwriteChannel(ch, packet->data, packet->size) < 0)
+        return -1;
+
+    channel->head = packet->next;
+    if (channel->head == NULL)
+        channel->tail = NULL;
+    channel->queued--;
+    mux->last = ch;
+
+    free(packet->data);
+    free(packet);
+    return ch;
+}
+
+void muxFree(t_mux *mux)
+{
+    if (mux == NULL)
+        return;
+
+    for (int i = 0; i < MAX_CHANNELS; i++)
+    {
+        t_mux_packet *packet = mux->channels[i].head;
+        while (packet != NULL)
+        {
+            t_mux_packet *next = packet->next;
+            free(packet->data);
+            free(packet);
+            packet = next;
+        }
+        mux->channels[i].head = mux->channels[i].tail = NULL;
+        mux->channels[i].queued = 0;
+    }
+}
@@ -0,0 +1,160 @@
+// Shared memory telemetry, see telemetry.h
+
+#include "telemetry.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+static t_telemetry *segment = NULL;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t writeLock = PTHREAD_MUTEX_INITIALIZER;
+static char segmentName[256];
+
+// Where the current file started, for its ETA
+static double fileStart;
+static uint64_t fileBase;
+
+// Readers spin this many times before giving up on a busy segment
+#define SNAPSHOT_TRIES 1000
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void removeSegment(void)
+{
+    shm_unlink(segmentName);
+}
+
+static void openSegment(void)
+{
+    const char *name = getConfig()->telemetry;
+    if (name == NULL)
+        return;
+
+    snprintf(segmentName, sizeof(segmentName), "%s%s", name[0] == '/' ? "" : "/", name);
+    int fd = shm_open(segmentName, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("Couldn't create the telemetry segment '%s'!\n", segmentName);
+        return;
+    }
+
+    void *mapped = MAP_FAILED;
+    if (ftruncate(fd, sizeof(t_telemetry)) == 0)
+        mapped = mmap(NULL, sizeof(t_telemetry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        printf("Couldn't map the telemetry segment '%s'!\n", segmentName);
+        shm_unlink(segmentName);
+        return;
+    }
+
+    t_telemetry *t = mapped;
+    t->version = TELEMETRY_VERSION;
+    t->pid = getpid();
+    t->start = t->updated = now();
+    t->etaSeconds = -1;
+    __atomic_store_n(&t->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+
+    segment = t;
+    atexit(removeSegment);
+    printf("Publishing telemetry in '%s'\n", segmentName);
+}
+
+////////////////////////////////////////////////
+// WRITER
+////////////////////////////////////////////////
+t_telemetry *telemetryBegin(void)
+{
+    pthread_once(&once, openSegment);
+    if (segment == NULL)
+        return NULL;
+
+    // Writers take turns, readers never block them
+    pthread_mutex_lock(&writeLock);
+    __atomic_store_n(&segment->seq, segment->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return segment;
+}
+
+void telemetryEnd(t_telemetry *t)
+{
+    t->updated = now();
+    __atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&writeLock);
+}
+
+void telemetryFile(const char *name, uint64_t size, uint64_t done)
+{
+    t_telemetry *t = telemetryBegin();
+    if (t == NULL)
+        return;
+
+    snprintf(t->fileName, sizeof(t->fileName), "%s", name);
+    t->fileSize = size;
+    t->fileDone = done;
+    t->etaSeconds = -1;
+    fileStart = now();
+    fileBase = done;
+    telemetryEnd(t);
+}
+
+void telemetryProgress(uint64_t done)
+{
+    t_telemetry *t = telemetryBegin();
+    if (t == NULL)
+        return;
+
+    t->fileDone = done;
+
+    // From the average rate of this file so far
+    double elapsed = now() - fileStart;
+    if (t->fileSize > 0 && done > fileBase && elapsed > 0)
+    {
+        double rate = (done - fileBase) / elapsed;
+        t->etaSeconds = t->fileSize > done ? (t->fileSize - done) / rate + 0.5 : 0;
+    }
+    telemetryEnd(t);
+}
+
+void telemetryFileDone(void)
+{
+    t_telemetry *t = telemetryBegin();
+    if (t == NULL)
+        return;
+
+    t->filesDone++;
+    t->etaSeconds = 0;
+    telemetryEnd(t);
+}
+
+////////////////////////////////////////////////
+// READER
+////////////////////////////////////////////////
+int telemetrySnapshot(const t_telemetry *shared, t_telemetry *copy)
+{
+    for (int i = 0; i < SNAPSHOT_TRIES; i++)
+    {
+        uint32_t before = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        if (before & 1)
+            continue;
+
+        memcpy(copy, shared, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == before)
+            return 0;
+    }
+    return -1;
+}
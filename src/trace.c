@@ -0,0 +1,137 @@
+// Per-thread tracepoint rings, see trace.h
+
+#include "trace.h"
+
+const char *const traceStageNames[TR_STAGES] = {
+    [TR_LLWRITE] = "llwrite",
+    [TR_FRAME_BUILD] = "frame build",
+    [TR_SERIAL_WRITE] = "serial write",
+    [TR_ACK_WAIT] = "ack wait",
+    [TR_RETRANSMIT] = "retransmit",
+    [TR_LLREAD_WAIT] = "llread wait",
+    [TR_DECODE] = "decode",
+    [TR_BCC_CHECK] = "bcc2 check",
+    [TR_FREAD] = "fread",
+    [TR_FWRITE] = "fwrite",
+    [TR_DIGEST] = "digest",
+};
+
+#ifdef LL_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+// Events kept per thread, older ones are overwritten
+#define RING_SIZE (1 << 16)
+#define DEFAULT_TRACE_FILE "trace.bin"
+
+typedef struct s_trace_ring
+{
+    t_trace_event       events[RING_SIZE];
+    uint64_t            head;   // Written only by the owning thread
+    uint32_t            tid;
+    struct s_trace_ring *next;
+}   t_trace_ring;
+
+static __thread t_trace_ring *ring = NULL;
+static t_trace_ring *rings = NULL;
+static uint32_t nextTid = 0;
+
+// Clock at the first and the last event, to find the tick rate
+static uint64_t originTicks;
+static struct timespec originTime;
+
+static uint64_t nowNs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+uint64_t traceClock(void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return nowNs();
+#endif
+}
+
+static double ticksPerNs(void)
+{
+#ifdef HAVE_TSC
+    uint64_t ns = nowNs() - (originTime.tv_sec * 1000000000ULL + originTime.tv_nsec);
+    return ns > 0 ? (double)(traceClock() - originTicks) / ns : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+static void dumpRings(void)
+{
+    const char *path = getenv("LL_TRACE_FILE");
+    FILE *file = fopen(path != NULL ? path : DEFAULT_TRACE_FILE, "wb");
+    if (file == NULL)
+        return;
+
+    t_trace_header header = {.magic = TRACE_MAGIC, .ticksPerNs = ticksPerNs()};
+    t_trace_ring *first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (t_trace_ring *r = first; r != NULL; r = r->next)
+    {
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        header.count += head < RING_SIZE ? head : RING_SIZE;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (t_trace_ring *r = first; r != NULL; r = r->next)
+    {
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        for (uint64_t i = head < RING_SIZE ? 0 : head - RING_SIZE; i < head; i++)
+            fwrite(&r->events[i % RING_SIZE], sizeof(t_trace_event), 1, file);
+    }
+
+    fclose(file);
+}
+
+// Rings are pushed on a lock-free list and never freed, threads that exited
+// still show up in the dump
+static t_trace_ring *newRing(void)
+{
+    t_trace_ring *r = calloc(1, sizeof(t_trace_ring));
+    if (r == NULL)
+        return NULL;
+
+    r->tid = __atomic_fetch_add(&nextTid, 1, __ATOMIC_RELAXED);
+    if (r->tid == 0)
+    {
+        originTicks = traceClock();
+        clock_gettime(CLOCK_MONOTONIC_RAW, &originTime);
+        atexit(dumpRings);
+    }
+
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return r;
+}
+
+void traceRecord(t_trace_stage stage, uint64_t start)
+{
+    if (ring == NULL && (ring = newRing()) == NULL)
+        return;
+
+    t_trace_event *event = &ring->events[ring->head % RING_SIZE];
+    event->stage = stage;
+    event->tid = ring->tid;
+    event->start = start;
+    event->end = traceClock();
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
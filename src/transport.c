@@ -0,0 +1,824 @@
+// Byte transports for the link layer
+
+#define _GNU_SOURCE
+
+#include "transport.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "protocol.h"
+#include "serial_port.h"
+#include "utils.h"
+
+#define CONNECT_TRIES 50
+#define CONNECT_WAIT_US 100000
+#define RING_SIZE (64 * 1024)
+#define SIM_BITS_PER_BYTE 10 // 8N1
+
+static t_transport *newTransport(const t_transport_ops *ops, int fd, void *ctx)
+{
+    t_transport *t = calloc(1, sizeof(t_transport));
+    if (t == NULL)
+        return NULL;
+
+    t->ops = ops;
+    t->fd = fd;
+    t->ctx = ctx;
+    return t;
+}
+
+// Waits for the descriptor to become readable.
+// Returns -1 on error, 0 on timeout, 1 when readable.
+static int waitReadable(int fd, int timeoutMs)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+    int retv = poll(&pfd, 1, timeoutMs);
+    if (retv < 0)
+        return errno == EINTR ? 0 : -1;
+    if (retv == 0)
+        return 0;
+
+    // A pty master reports a hang up while nobody has the slave open
+    if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLIN))
+    {
+        usleep(timeoutMs * 1000);
+        return 0;
+    }
+
+    return 1;
+}
+
+////////////////////////////////////////////////
+// SERIAL PORT
+////////////////////////////////////////////////
+static int serialRead(t_transport *t, uint8_t *buf, size_t size, int timeoutMs)
+{
+    int retv = waitReadable(t->fd, timeoutMs);
+    if (retv <= 0)
+        return retv;
+
+    // VMIN = VTIME = 0: read returns whatever is already buffered
+    retv = read(t->fd, buf, size);
+    if (retv < 0 && (errno == EAGAIN || errno == EINTR || errno == EIO))
+        return 0;
+    return retv;
+}
+
+static int serialWrite(t_transport *t, const uint8_t *buf, size_t size)
+{
+    return writeBytesSerialPort(buf, size);
+}
+
+static int serialClose(t_transport *t)
+{
+    return closeSerialPort();
+}
+
+static const t_transport_ops serialOps = {"serial", serialRead, serialWrite, serialClose};
+
+// serial_port.c keeps a single global descriptor: one serial port per process
+static t_transport *openSerial(const char *path, int baudRate)
+{
+    int fd = openSerialPort(path, baudRate);
+    if (fd < 0)
+        return NULL;
+
+    return newTransport(&serialOps, fd, NULL);
+}
+
+////////////////////////////////////////////////
+// PSEUDO-TERMINAL
+////////////////////////////////////////////////
+static int fdWrite(t_transport *t, const uint8_t *buf, size_t size)
+{
+    int retv = write(t->fd, buf, size);
+    if (retv < 0 && errno == EIO)
+        return size; // Nobody on the other side, the bytes are lost like on an unplugged cable
+    return retv;
+}
+
+static int ptyClose(t_transport *t)
+{
+    if (t->ctx != NULL)
+    {
+        unlink(t->ctx);
+        free(t->ctx);
+    }
+    return close(t->fd);
+}
+
+static const t_transport_ops ptyOps = {"pty", serialRead, fdWrite, ptyClose};
+
+// The other end opens the symlinked slave as a regular serial port
+static t_transport *openPty(const char *link)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0)
+    {
+        perror("posix_openpt");
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    unlink(link);
+    if (symlink(ptsname(fd), link) < 0)
+    {
+        perror(link);
+        close(fd);
+        return NULL;
+    }
+
+    printf("[openPty] %s -> %s\n", link, ptsname(fd));
+    return newTransport(&ptyOps, fd, strdup(link));
+}
+
+////////////////////////////////////////////////
+// SOCKETS
+////////////////////////////////////////////////
+static int socketRead(t_transport *t, uint8_t *buf, size_t size, int timeoutMs)
+{
+    int retv = waitReadable(t->fd, timeoutMs);
+    if (retv <= 0)
+        return retv;
+
+    retv = recv(t->fd, buf, size, 0);
+    if (retv < 0 && (errno == EAGAIN || errno == EINTR || errno == ECONNREFUSED))
+        return 0;
+    // A peer that closes with our bytes unread resets the connection
+    if (retv == 0 || (retv < 0 && errno == ECONNRESET))
+    {
+        t->closed = TRUE;
+        return -1;
+    }
+    return retv;
+}
+
+static int socketWrite(t_transport *t, const uint8_t *buf, size_t size)
+{
+    int retv = send(t->fd, buf, size, MSG_NOSIGNAL);
+    if (retv < 0 && errno == ECONNREFUSED)
+        return size; // UDP peer not up yet, the datagram is lost
+    return retv;
+}
+
+static int socketClose(t_transport *t)
+{
+    if (t->ctx != NULL)
+    {
+        unlink(t->ctx);
+        free(t->ctx);
+    }
+    return close(t->fd);
+}
+
+static const t_transport_ops unixOps = {"unix", socketRead, socketWrite, socketClose};
+static const t_transport_ops udpOps = {"udp", socketRead, socketWrite, socketClose};
+
+static t_transport *openUnix(const char *path, LinkLayerRole role)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return info("openUnix", "Socket path is too long"), NULL;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return perror("socket"), NULL;
+
+    if (role == LlTx)
+    {
+        // The receiver may not be listening yet
+        for (int try = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0; try++)
+        {
+            if (try == CONNECT_TRIES || (errno != ENOENT && errno != ECONNREFUSED))
+                return perror(path), close(fd), NULL;
+            usleep(CONNECT_WAIT_US);
+        }
+        return newTransport(&unixOps, fd, NULL);
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0)
+        return perror(path), close(fd), NULL;
+
+    int conn = accept(fd, NULL, NULL);
+    close(fd);
+    if (conn < 0)
+        return perror("accept"), unlink(path), NULL;
+
+    return newTransport(&unixOps, conn, strdup(path));
+}
+
+static t_transport *openUdp(const char *ports)
+{
+    unsigned local = 0, peer = 0;
+    if (sscanf(ports, "%u:%u", &local, &peer) != 2 || local > 65535 || peer > 65535)
+        return info("openUdp", "Expected udp:<local port>:<peer port>"), NULL;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return perror("socket"), NULL;
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+
+    addr.sin_port = htons(local);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return perror("bind"), close(fd), NULL;
+
+    addr.sin_port = htons(peer);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return perror("connect"), close(fd), NULL;
+
+    return newTransport(&udpOps, fd, NULL);
+}
+
+////////////////////////////////////////////////
+// IN-MEMORY RING BUFFERS
+////////////////////////////////////////////////
+// A simulated line: bytes leave one at a time at the baud rate, arrive after
+// the propagation delay, and have their bits flipped with probability ber
+typedef struct s_sim
+{
+    double      byteTime;   // Seconds per byte, 0 for no pacing
+    double      delay;      // Seconds
+    double      byteErrors; // Probability that a byte has a flipped bit
+    uint64_t    rng;
+    double      lineFree;   // When the last byte written is fully sent
+}   t_sim;
+
+typedef struct s_ring
+{
+    uint8_t         buf[RING_SIZE];
+    double          *arrival;   // Per byte when pacing or delaying
+    t_sim           sim;
+    size_t          head;
+    size_t          count;
+    int             closed;
+    int             refs;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+}   t_ring;
+
+typedef struct s_mem
+{
+    t_ring  *in;
+    t_ring  *out;
+}   t_mem;
+
+static double monotonicNow(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static struct timespec toTimespec(double seconds)
+{
+    struct timespec t = {.tv_sec = (time_t)seconds};
+    t.tv_nsec = (long)((seconds - t.tv_sec) * 1e9);
+    return t;
+}
+
+// xorshift64*, reproducible for a given seed
+static double simRandom(t_sim *sim)
+{
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return ((sim->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Options after the name: mem:<name>,baud=<bps>,delay=<ms>,ber=<p>,seed=<n>
+static int parseSim(const char *spec, t_sim *ab, t_sim *ba)
+{
+    double baud = 0, delayMs = 0, ber = 0;
+    unsigned long long seed = 1;
+
+    const char *option = strchr(spec, ',');
+    while (option != NULL)
+    {
+        option++;
+        if (sscanf(option, "baud=%lf", &baud) != 1 && sscanf(option, "delay=%lf", &delayMs) != 1 &&
+            sscanf(option, "ber=%lf", &ber) != 1 && sscanf(option, "seed=%llu", &seed) != 1)
+            return info("openMem", "Expected mem:<name>[,baud=<bps>][,delay=<ms>][,ber=<p>][,seed=<n>]"), -1;
+        option = strchr(option, ',');
+    }
+    if (baud < 0 || delayMs < 0 || ber < 0 || ber >= 1)
+        return info("openMem", "Invalid line simulation parameters"), -1;
+
+    ab->byteTime = ba->byteTime = baud > 0 ? SIM_BITS_PER_BYTE / baud : 0;
+    ab->delay = ba->delay = delayMs / 1000;
+    ab->rng = seed * 2 + 1;
+    ba->rng = seed * 2 + 2;
+
+    // Two errors in one byte are rare enough to leave out at useful rates
+    double good = 1;
+    for (int i = 0; i < 8; i++)
+        good *= 1 - ber;
+    ab->byteErrors = ba->byteErrors = 1 - good;
+    return 0;
+}
+
+static t_ring *newRing(void)
+{
+    t_ring *ring = calloc(1, sizeof(t_ring));
+    if (ring == NULL)
+        return NULL;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ring->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&ring->lock, NULL);
+    ring->refs = 2;
+    return ring;
+}
+
+static void releaseRing(t_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->closed = TRUE;
+    int refs = --ring->refs;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+
+    if (refs > 0)
+        return;
+
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->cond);
+    free(ring->arrival);
+    free(ring);
+}
+
+static int memRead(t_transport *t, uint8_t *buf, size_t size, int timeoutMs)
+{
+    t_ring *ring = ((t_mem *)t->ctx)->in;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    while (ring->count == 0 && !ring->closed)
+        if (pthread_cond_timedwait(&ring->cond, &ring->lock, &deadline) != 0)
+            break;
+
+    // A simulated line only hands out the bytes that already arrived
+    size_t arrived = ring->count;
+    if (ring->arrival != NULL && ring->count > 0)
+    {
+        double now = monotonicNow();
+        double first = ring->arrival[ring->head];
+        double until = deadline.tv_sec + deadline.tv_nsec / 1e9;
+        if (first > now)
+        {
+            struct timespec wake = toTimespec(first < until ? first : until);
+            pthread_mutex_unlock(&ring->lock);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+            pthread_mutex_lock(&ring->lock);
+            now = monotonicNow();
+        }
+
+        arrived = 0;
+        while (arrived < ring->count && arrived < size && ring->arrival[(ring->head + arrived) % RING_SIZE] <= now)
+            arrived++;
+    }
+
+    if (arrived == 0)
+    {
+        t->closed = ring->closed && ring->count == 0;
+        pthread_mutex_unlock(&ring->lock);
+        return t->closed ? -1 : 0;
+    }
+
+    size_t n = size < arrived ? size : arrived;
+    for (size_t i = 0; i < n; i++)
+        buf[i] = ring->buf[(ring->head + i) % RING_SIZE];
+    ring->head = (ring->head + n) % RING_SIZE;
+    ring->count -= n;
+
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+    return n;
+}
+
+static int memWrite(t_transport *t, const uint8_t *buf, size_t size)
+{
+    t_ring *ring = ((t_mem *)t->ctx)->out;
+
+    pthread_mutex_lock(&ring->lock);
+    while (ring->count == RING_SIZE && !ring->closed)
+        pthread_cond_wait(&ring->cond, &ring->lock);
+
+    if (ring->closed)
+        return pthread_mutex_unlock(&ring->lock), -1;
+
+    size_t n = RING_SIZE - ring->count;
+    n = size < n ? size : n;
+    size_t tail = (ring->head + ring->count) % RING_SIZE;
+    for (size_t i = 0; i < n; i++)
+        ring->buf[(tail + i) % RING_SIZE] = buf[i];
+    ring->count += n;
+
+    t_sim *sim = &ring->sim;
+    for (size_t i = 0; sim->byteErrors > 0 && i < n; i++)
+    {
+        double u = simRandom(sim);
+        if (u < sim->byteErrors)
+            ring->buf[(tail + i) % RING_SIZE] ^= 1 << (int)(u / sim->byteErrors * 8);
+    }
+
+    if (ring->arrival != NULL)
+    {
+        double now = monotonicNow();
+        if (sim->lineFree < now)
+            sim->lineFree = now;
+        for (size_t i = 0; i < n; i++)
+        {
+            sim->lineFree += sim->byteTime;
+            ring->arrival[(tail + i) % RING_SIZE] = sim->lineFree + sim->delay;
+        }
+    }
+
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+    return n;
+}
+
+static int memClose(t_transport *t)
+{
+    t_mem *mem = t->ctx;
+    releaseRing(mem->in);
+    releaseRing(mem->out);
+    free(mem);
+    return 0;
+}
+
+static const t_transport_ops memOps = {"mem", memRead, memWrite, memClose};
+static const t_transport_ops socketpairOps = {"socketpair", socketRead, socketWrite, socketClose};
+
+static int newMemPair(const char *spec, t_transport **a, t_transport **b)
+{
+    t_mem *ma = calloc(1, sizeof(t_mem));
+    t_mem *mb = calloc(1, sizeof(t_mem));
+    t_ring *ab = newRing();
+    t_ring *ba = newRing();
+    if (ma == NULL || mb == NULL || ab == NULL || ba == NULL || parseSim(spec, &ab->sim, &ba->sim) < 0)
+        return free(ma), free(mb), free(ab), free(ba), -1;
+
+    if (ab->sim.byteTime > 0 || ab->sim.delay > 0)
+    {
+        ab->arrival = calloc(RING_SIZE, sizeof(double));
+        ba->arrival = calloc(RING_SIZE, sizeof(double));
+        if (ab->arrival == NULL || ba->arrival == NULL)
+            return free(ma), free(mb), free(ab->arrival), free(ba->arrival), free(ab), free(ba), -1;
+    }
+
+    ma->out = mb->in = ab;
+    ma->in = mb->out = ba;
+    *a = newTransport(&memOps, -1, ma);
+    *b = newTransport(&memOps, -1, mb);
+    return 0;
+}
+
+static int newSocketPair(const char *spec, t_transport **a, t_transport **b)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        return perror("socketpair"), -1;
+
+    *a = newTransport(&socketpairOps, fds[0], NULL);
+    *b = newTransport(&socketpairOps, fds[1], NULL);
+    return 0;
+}
+
+// In-process pairs: the first endpoint to open a name creates both ends and
+// parks the second one here until the other endpoint opens the same name.
+typedef struct s_pending
+{
+    char                name[50];
+    t_transport         *peer;
+    struct s_pending    *next;
+}   t_pending;
+
+static t_pending *pending = NULL;
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+
+static t_transport *openPair(const char *name, int (*newPair)(const char *, t_transport **, t_transport **))
+{
+    t_transport *mine = NULL;
+
+    pthread_mutex_lock(&pendingLock);
+
+    for (t_pending **p = &pending; *p != NULL; p = &(*p)->next)
+    {
+        if (strcmp((*p)->name, name) != 0)
+            continue;
+
+        t_pending *found = *p;
+        *p = found->next;
+        mine = found->peer;
+        free(found);
+        return pthread_mutex_unlock(&pendingLock), mine;
+    }
+
+    t_pending *entry = calloc(1, sizeof(t_pending));
+    if (entry != NULL && newPair(name, &mine, &entry->peer) == 0)
+    {
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+        entry->next = pending;
+        pending = entry;
+    }
+    else
+    {
+        free(entry);
+        mine = NULL;
+    }
+
+    pthread_mutex_unlock(&pendingLock);
+    return mine;
+}
+
+////////////////////////////////////////////////
+// REPLAY
+////////////////////////////////////////////////
+// Plays a capture (see capture.h) back to a receiver: reads return the bytes
+// the captured receiver read, or the captured transmitter wrote, in the same
+// spans. Writes go nowhere but are counted, and a span is only handed out
+// once the link has written as much as the captured side had by then, so the
+// link is paced by its own answers like on the line, only without the line.
+// A receiver that answers RNR gets the refused span again after its RR, as a
+// transmitter would send it. With ",timed" spans also wait for their time.
+#define REPLAY_STALL_MS 100     // A link that answers less than the capture is let through,
+                                // and the line stays idle this long after the end
+
+typedef struct s_replay
+{
+    t_capture_reader    reader;
+    t_capture_dir       feed;
+    int                 timed;
+    double              start;
+    t_capture_record    record;     // The span being handed out
+    size_t              offset;
+    long                groupPos;   // First span after the last answer, fed again after RNR
+    double              groupTime;
+    int                 answered;
+    size_t              owed;       // Bytes the captured side wrote before the span
+    size_t              written;    // Bytes the link wrote
+    int                 notReady;   // The link answered RNR
+    int                 rewind;     // and then RR, the group goes again
+    double              stalled;    // Since when the span waits for the link, 0 if it doesn't
+    double              ended;      // When the capture ran out
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+}   t_replay;
+
+static int isRnr(const uint8_t *buf, size_t size)
+{
+    return size == 5 && buf[0] == FLAG && (buf[2] == CTRL_RNR0 || buf[2] == CTRL_RNR1);
+}
+
+// Waits for the link to be ready and to write its share before the span, or
+// until the deadline. Returns FALSE on timeout.
+static int replayPaced(t_replay *r, double deadline)
+{
+    pthread_mutex_lock(&r->lock);
+    while (r->notReady)
+    {
+        struct timespec wake = toTimespec(deadline);
+        if (pthread_cond_timedwait(&r->cond, &r->lock, &wake) != 0)
+            return pthread_mutex_unlock(&r->lock), FALSE;
+    }
+
+    if (r->rewind)
+    {
+        r->rewind = FALSE;
+        fseek(r->reader.file, r->groupPos, SEEK_SET);
+        r->reader.time = r->groupTime;
+        r->record.size = r->offset = 0;
+        return pthread_mutex_unlock(&r->lock), TRUE;
+    }
+
+    if (r->offset > 0)
+        return pthread_mutex_unlock(&r->lock), TRUE;
+
+    if (r->stalled == 0)
+        r->stalled = monotonicNow();
+    double giveUp = r->stalled + REPLAY_STALL_MS / 1000.0;
+    while (r->written < r->owed && monotonicNow() < giveUp)
+    {
+        if (monotonicNow() >= deadline)
+            return pthread_mutex_unlock(&r->lock), FALSE;
+        struct timespec wake = toTimespec(deadline < giveUp ? deadline : giveUp);
+        pthread_cond_timedwait(&r->cond, &r->lock, &wake);
+    }
+
+    if (r->written < r->owed)
+        r->written = r->owed;
+    r->stalled = 0;
+    pthread_mutex_unlock(&r->lock);
+    return TRUE;
+}
+
+// Moves to the next span to feed, counting the answers on the way
+static int replayNext(t_replay *r)
+{
+    while (1)
+    {
+        long pos = ftell(r->reader.file);
+        double time = r->reader.time;
+        int retv = captureNext(&r->reader, &r->record);
+        if (retv <= 0)
+            return retv;
+
+        if (r->record.dir != r->feed)
+        {
+            pthread_mutex_lock(&r->lock);
+            r->owed += r->record.size;
+            pthread_mutex_unlock(&r->lock);
+            r->answered = TRUE;
+            continue;
+        }
+
+        if (r->answered || r->groupPos == 0)
+        {
+            r->groupPos = pos;
+            r->groupTime = time;
+            r->answered = FALSE;
+        }
+        r->offset = 0;
+        return 1;
+    }
+}
+
+static int replayRead(t_transport *t, uint8_t *buf, size_t size, int timeoutMs)
+{
+    t_replay *r = t->ctx;
+    double deadline = monotonicNow() + timeoutMs / 1000.0;
+
+    if (!replayPaced(r, deadline))
+        return 0;
+
+    if (r->offset == r->record.size)
+    {
+        if (replayNext(r) <= 0)
+        {
+            // Whatever the link still waits for (the UA to its DISC) went out last
+            r->record.size = r->offset = 0;
+            if (r->ended == 0)
+                r->ended = monotonicNow();
+            double until = r->ended + REPLAY_STALL_MS / 1000.0;
+            if (monotonicNow() < until)
+            {
+                struct timespec wake = toTimespec(until < deadline ? until : deadline);
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+                return 0;
+            }
+            t->closed = TRUE;
+            return -1;
+        }
+        if (!replayPaced(r, deadline))
+            return 0;
+    }
+
+    if (r->timed)
+    {
+        double due = r->start + r->record.time;
+        if (due > monotonicNow())
+        {
+            struct timespec wake = toTimespec(due < deadline ? due : deadline);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+            if (due > monotonicNow())
+                return 0;
+        }
+    }
+
+    size_t n = r->record.size - r->offset < size ? r->record.size - r->offset : size;
+    memcpy(buf, r->record.bytes + r->offset, n);
+    r->offset += n;
+    return n;
+}
+
+static int replayWrite(t_transport *t, const uint8_t *buf, size_t size)
+{
+    t_replay *r = t->ctx;
+    pthread_mutex_lock(&r->lock);
+    if (isRnr(buf, size))
+        r->notReady = TRUE;
+    else if (r->notReady)
+    {
+        // The RR after RNR isn't in the capture
+        r->notReady = FALSE;
+        r->rewind = TRUE;
+    }
+    else
+        r->written += size;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    return size;
+}
+
+static int replayClose(t_transport *t)
+{
+    t_replay *r = t->ctx;
+    captureReaderClose(&r->reader);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r);
+    return 0;
+}
+
+static const t_transport_ops replayOps = {"replay", replayRead, replayWrite, replayClose};
+
+// replay:<capture>[,timed]
+static t_transport *openReplay(const char *spec)
+{
+    t_replay *r = calloc(1, sizeof(t_replay));
+    if (r == NULL)
+        return NULL;
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s", spec);
+    char *option = strrchr(path, ',');
+    if (option != NULL && strcmp(option, ",timed") == 0)
+    {
+        *option = '\0';
+        r->timed = TRUE;
+    }
+
+    if (captureReaderOpen(&r->reader, path) < 0)
+    {
+        printf("Couldn't read the capture '%s'!\n", path);
+        return free(r), NULL;
+    }
+    r->feed = captureFeedDir(&r->reader.header);
+    r->start = monotonicNow();
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&r->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&r->lock, NULL);
+
+    t_transport *t = newTransport(&replayOps, -1, r);
+    if (t == NULL)
+        replayClose(&(t_transport){.ctx = r});
+    return t;
+}
+
+////////////////////////////////////////////////
+// DISPATCH
+////////////////////////////////////////////////
+t_transport *transportOpen(const char *spec, int baudRate, LinkLayerRole role)
+{
+    if (spec == NULL)
+        return NULL;
+
+    if (strncmp(spec, "pty:", 4) == 0)
+        return openPty(spec + 4);
+    if (strncmp(spec, "unix:", 5) == 0)
+        return openUnix(spec + 5, role);
+    if (strncmp(spec, "udp:", 4) == 0)
+        return openUdp(spec + 4);
+    if (strncmp(spec, "socketpair:", 11) == 0)
+        return openPair(spec, newSocketPair);
+    if (strncmp(spec, "mem:", 4) == 0)
+        return openPair(spec, newMemPair);
+    if (strncmp(spec, "replay:", 7) == 0)
+        return openReplay(spec + 7);
+
+    return openSerial(spec, baudRate);
+}
+
+int transportClose(t_transport *t)
+{
+    if (t == NULL)
+        return -1;
+
+    int retv = t->ops->close(t);
+    free(t);
+    return retv;
+}
@@ -1,16 +1,14 @@
 #include "utils.h"
 
-static size_t ndivs(size_t n) {
+#include "log.h"
+
+// Sizes and offsets are 64 bit even where size_t / long are 32 bit
+static size_t ndivs(uint64_t n) {
   size_t res = 0;
 
   if (n == 0)
     return 1;
   
-  if (n < 0) {
-    res++;
-    n *= -1;
-  }
-  
   while (n != 0) {
     n /= 10;
     res++;
@@ -19,7 +17,7 @@ static size_t ndivs(size_t n) {
   return res;
 }
 
-uint8_t *ultoua(size_t n) {
+uint8_t *ultoua(uint64_t n) {
   size_t i = ndivs(n);
 
   uint8_t *res = calloc(i + 1, sizeof(uint8_t));
@@ -31,23 +29,20 @@ uint8_t *ultoua(size_t n) {
   if (n == 0)
     res[i] = '0';
 
-  if (n < 0)
-    res[0] = '-';
-
   while (n != 0) {
-    res[i--] = '0' + abs(n % 10);
+    res[i--] = '0' + n % 10;
     n /= 10;
   }
 
   return res;
 }
 
-size_t uatoi(uint8_t* n, uint8_t size)
+uint64_t uatoi(uint8_t* n, uint8_t size)
 {
-    size_t ret = 0;
+    uint64_t ret = 0;
     if (n == NULL)
         return 0;
-    for (uint8_t i = 0; i < size; i++)
+    for (uint8_t i = 0; i < size && n[i] >= '0' && n[i] <= '9'; i++)
         ret = ret * 10 + n[i] - '0';
     return ret;
 }
@@ -55,20 +50,19 @@ size_t uatoi(uint8_t* n, uint8_t size)
 int spError(char *funcName, int isRead)
 {
     if (isRead)
-        printf("[%s] Got error reading from serial port\n", funcName);
+        logText(LOG_ERROR, funcName, "Got error reading from serial port");
     else
-        printf("[%s] Got error writing to serial port\n", funcName);
+        logText(LOG_ERROR, funcName, "Got error writing to serial port");
     return -1;
 }
 
 int err(char *funcName, char *msg)
 {
-    info(funcName, msg);
+    logText(LOG_ERROR, funcName, msg);
     return -1;
 }
 
 void info(char *funcName, char *msg)
 {
-    printf("[%s] %s\n", funcName, msg);
+    logText(LOG_INFO, funcName, msg);
 }
-
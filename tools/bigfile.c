@@ -0,0 +1,191 @@
+// Large file check: moves a sparse 8 GB file through the in-process
+// transport and compares the copy with the original.
+//
+// Usage: bigfile [directory] [size in GB]
+//
+// The file is mostly one hole, with data blocks at the start, on both sides
+// of the 4 GB mark and at the very end, so every 32 bit size or offset shows
+// up as a wrong size or a wrong block. Holes go as HOLE packets (LL_SPARSE),
+// so the run takes seconds and the copy stays sparse. Exits non-zero on any
+// mismatch and prints the time taken.
+
+#define _FILE_OFFSET_BITS 64
+
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link_layer.h"
+#include "transfer.h"
+
+#define LINK_SPEC "mem:bigfile"
+#define N_TRIES 3
+#define TIMEOUT 4
+#define GB (1024ULL * 1024 * 1024)
+#define BLOCK_SIZE (64 * 1024)
+
+typedef struct s_bigfile
+{
+    char        source[PATH_MAX];
+    char        copy[PATH_MAX];
+    uint64_t    size;
+    uint64_t    offsets[5];
+    int         nOffsets;
+    int         rxResult;
+}   t_bigfile;
+
+// Block contents depend on the offset, so a block written at the wrong place
+// does not compare equal
+static void fillBlock(uint8_t *block, uint64_t offset)
+{
+    uint64_t x = offset | 1;
+    for (size_t i = 0; i < BLOCK_SIZE; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        block[i] = x;
+    }
+}
+
+static int createSource(t_bigfile *big)
+{
+    FILE *file = fopen(big->source, "wb");
+    if (file == NULL)
+        return -1;
+
+    uint8_t block[BLOCK_SIZE];
+    for (int i = 0; i < big->nOffsets; i++)
+    {
+        fillBlock(block, big->offsets[i]);
+        if (fseeko(file, big->offsets[i], SEEK_SET) < 0 || fwrite(block, 1, BLOCK_SIZE, file) != BLOCK_SIZE)
+            return fclose(file), -1;
+    }
+
+    if (fflush(file) != 0 || ftruncate(fileno(file), big->size) < 0)
+        return fclose(file), -1;
+    return fclose(file);
+}
+
+static int checkCopy(const t_bigfile *big)
+{
+    struct stat st;
+    if (stat(big->copy, &st) < 0)
+    {
+        printf("Copy '%s' is missing!\n", big->copy);
+        return -1;
+    }
+    if ((uint64_t)st.st_size != big->size)
+    {
+        printf("Copy is %" PRIu64 " bytes instead of %" PRIu64 "!\n", (uint64_t)st.st_size, big->size);
+        return -1;
+    }
+    printf("Copy uses %" PRIu64 " bytes of disk for %" PRIu64 " bytes of file\n",
+           (uint64_t)st.st_blocks * 512, (uint64_t)st.st_size);
+
+    FILE *file = fopen(big->copy, "rb");
+    if (file == NULL)
+        return -1;
+
+    uint8_t expected[BLOCK_SIZE], block[BLOCK_SIZE];
+    for (int i = 0; i < big->nOffsets; i++)
+    {
+        fillBlock(expected, big->offsets[i]);
+        if (fseeko(file, big->offsets[i], SEEK_SET) < 0 || fread(block, 1, BLOCK_SIZE, file) != BLOCK_SIZE ||
+            memcmp(block, expected, BLOCK_SIZE) != 0)
+        {
+            printf("Block at byte %" PRIu64 " differs!\n", big->offsets[i]);
+            return fclose(file), -1;
+        }
+    }
+
+    // Some of the hole must read back as zeros too
+    memset(expected, 0, BLOCK_SIZE);
+    if (fseeko(file, big->size / 2 + BLOCK_SIZE, SEEK_SET) < 0 || fread(block, 1, BLOCK_SIZE, file) != BLOCK_SIZE ||
+        memcmp(block, expected, BLOCK_SIZE) != 0)
+    {
+        printf("Hole did not read back as zeros!\n");
+        return fclose(file), -1;
+    }
+
+    return fclose(file);
+}
+
+static int openLink(LinkLayerRole role)
+{
+    LinkLayer params = {.role = role, .baudRate = 0, .nRetransmissions = N_TRIES, .timeout = TIMEOUT};
+    snprintf(params.serialPort, sizeof(params.serialPort), "%s", LINK_SPEC);
+    return llopen(params);
+}
+
+static void *receiver(void *arg)
+{
+    t_bigfile *big = arg;
+
+    big->rxResult = -1;
+    if (openLink(LlRx) < 0)
+        return NULL;
+    big->rxResult = receiveFiles(big->copy);
+    llclose(FALSE);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = argc > 1 ? argv[1] : ".";
+    uint64_t gb = argc > 2 ? strtoull(argv[2], NULL, 10) : 8;
+    if (gb < 5)
+    {
+        printf("Usage: %s [directory] [size in GB, at least 5]\n", argv[0]);
+        return 1;
+    }
+
+    t_bigfile big = {.size = gb * GB};
+    snprintf(big.source, sizeof(big.source), "%s/bigfile.src", dir);
+    snprintf(big.copy, sizeof(big.copy), "%s/bigfile.dst", dir);
+    big.offsets[big.nOffsets++] = 0;
+    big.offsets[big.nOffsets++] = 4 * GB - BLOCK_SIZE;
+    big.offsets[big.nOffsets++] = 4 * GB;
+    big.offsets[big.nOffsets++] = 4 * GB + 1024 * 1024 + 12345;
+    big.offsets[big.nOffsets++] = big.size - BLOCK_SIZE;
+
+    if (createSource(&big) < 0)
+    {
+        perror("Couldn't create the source file");
+        return 1;
+    }
+    unlink(big.copy);
+    setenv("LL_SPARSE", "1", 1);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t rx;
+    pthread_create(&rx, NULL, receiver, &big);
+
+    int txResult = -1;
+    if (openLink(LlTx) >= 0)
+    {
+        txResult = sendFile(big.source);
+        llclose(FALSE);
+    }
+    pthread_join(rx, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    int retv = txResult < 0 || big.rxResult < 0 || checkCopy(&big) < 0;
+    printf("\n%s: %" PRIu64 " GB in %.2f s (%.1f GB/s apparent)\n", retv ? "FAILED" : "OK", gb,
+           elapsed, gb / elapsed);
+
+    unlink(big.source);
+    unlink(big.copy);
+    return retv;
+}
@@ -0,0 +1,522 @@
+// Experiment runner over the cable emulator: starts bin/cable, sweeps one of
+// the bit error rate, the propagation delay or the frame size through the
+// cable's stdin commands, and for every point runs bin/main rx and tx N times.
+// The tx side's llclose statistics (LL_METRICS) give the measured efficiency,
+// printed as one CSV row per point next to the stop-and-wait efficiency the
+// same point should have in theory.
+//
+// Usage: cablerun [-x ber|prop|size] [-v values] [-e ber] [-d prop us] [-s size]
+//                 [-b baud] [-n repeats] [-f file] [-l time limit s] [-k metrics.csv]
+//                 [-c cable] [-m main] [-T tx port] [-R rx port]
+//
+// Values are comma separated, e.g. cablerun -x prop -v 0,10000,50000,100000.
+// The size is the file data per packet (LL_CHUNK). Every run's llclose row is
+// appended to the -k file, so the raw numbers are kept if wanted.
+//
+// The theory is the stop-and-wait efficiency of link_model.h, with the
+// stuffing of the file sent. It counts a damaged frame as one more cycle; a
+// lost RR costs a whole timeout, so the measured curve falls below it as the
+// bit error rate grows.
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link_model.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "sweep.h"
+
+#define PACKET_HEADER 4     // Of a data packet, in front of the file data
+#define COMMAND_GAP_US 200000   // The cable takes whatever one read returns as one command
+#define CABLE_START_S 10
+#define CABLE_SETTLE_US 1500000 // From its ports showing up to reading its commands
+#define RX_START_US 500000
+#define SETTLE_US 1000000
+
+typedef enum
+{
+    SWEEP_BER,
+    SWEEP_PROP,
+    SWEEP_SIZE
+}   t_sweep;
+
+typedef struct s_runner
+{
+    const char  *cable;
+    const char  *program;
+    const char  *txPort;
+    const char  *rxPort;
+    const char  *file;
+    char        copy[64];
+    char        cableLog[64];
+    char        metrics[256];
+    int         keepMetrics;
+    int         baudRate;
+    int         repeats;
+    int         timeLimit;
+    double      stuffing;   // Share of file bytes that are FLAG or ESCAPE
+    size_t      fileSize;
+    t_sweep     sweep;
+    t_list      values;
+    double      ber;
+    double      prop;       // Microseconds
+    int         size;
+    int         cableIn;    // Write end of the cable's stdin
+    pid_t       cablePid;   // Also its process group, with the socat it starts
+}   t_runner;
+
+// The tx side's llclose row
+typedef struct s_run
+{
+    int     ok;
+    double  elapsed;
+    double  efficiency;
+    double  frames;
+    double  retxTimeout;
+    double  retxRej;
+    double  rttMedian;
+}   t_run;
+
+static const char *const sweepNames[] = {"ber", "prop", "size"};
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int parseSweep(t_sweep *sweep, const char *name)
+{
+    for (int i = SWEEP_BER; i <= SWEEP_SIZE; i++)
+        if (strcmp(name, sweepNames[i]) == 0)
+            return *sweep = i, 0;
+    return -1;
+}
+
+static int measureFile(t_runner *r)
+{
+    FILE *file = fopen(r->file, "rb");
+    if (file == NULL)
+        return -1;
+
+    size_t special = 0;
+    int c;
+    r->fileSize = 0;
+    while ((c = fgetc(file)) != EOF)
+    {
+        r->fileSize++;
+        special += c == FLAG || c == ESCAPE;
+    }
+    fclose(file);
+    r->stuffing = r->fileSize > 0 ? (double)special / r->fileSize : 0;
+    return r->fileSize > 0 ? 0 : -1;
+}
+
+static int sameFiles(const char *a, const char *b)
+{
+    FILE *x = fopen(a, "rb"), *y = fopen(b, "rb");
+    int same = x != NULL && y != NULL;
+    while (same)
+    {
+        int c = fgetc(x);
+        same = c == fgetc(y);
+        if (c == EOF)
+            break;
+    }
+    if (x != NULL)
+        fclose(x);
+    if (y != NULL)
+        fclose(y);
+    return same;
+}
+
+static double theory(const t_runner *r, double ber, double prop, int size)
+{
+    t_line line = {.baudRate = r->baudRate, .prop = prop / 1e6, .ber = ber, .stuffing = r->stuffing};
+    return modelEfficiency(&line, size + PACKET_HEADER, ARQ_STOP_AND_WAIT, 1);
+}
+
+////////////////////////////////////////////////
+// PROCESSES
+////////////////////////////////////////////////
+// Starts a program with its output in a file, or nowhere. The environment
+// entries are NAME=value strings, a NAME alone unsets it. A program in its
+// own process group can be killed along with whatever it starts.
+static pid_t spawn(char *const argv[], const char *const env[], const char *output, int input, int group)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid > 0 && group)
+        setpgid(pid, pid);
+    if (pid != 0)
+        return pid;
+
+    if (group)
+        setpgid(0, 0);
+
+    for (int i = 0; env != NULL && env[i] != NULL; i++)
+    {
+        const char *value = strchr(env[i], '=');
+        if (value == NULL)
+            unsetenv(env[i]);
+        else
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "%.*s", (int)(value - env[i]), env[i]);
+            setenv(name, value + 1, 1);
+        }
+    }
+
+    if (input >= 0 && dup2(input, STDIN_FILENO) < 0)
+        _exit(127);
+    if (freopen(output != NULL ? output : "/dev/null", "w", stdout) == NULL ||
+        dup2(STDOUT_FILENO, STDERR_FILENO) < 0)
+        _exit(127);
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+// Waits for a process until the deadline, then kills it
+static int waitUntil(pid_t pid, double deadline)
+{
+    int status;
+    while (waitpid(pid, &status, WNOHANG) == 0)
+    {
+        if (now() >= deadline)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        usleep(50000);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+////////////////////////////////////////////////
+// CABLE
+////////////////////////////////////////////////
+static int cableCommand(t_runner *r, const char *fmt, ...)
+{
+    char line[64];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line) - 1, fmt, args);
+    va_end(args);
+    if (len < 0 || len >= (int)sizeof(line) - 1)
+        return -1;
+
+    line[len++] = '\n';
+    fprintf(stderr, "cable: %.*s", len, line);
+    if (write(r->cableIn, line, len) != len)
+        return -1;
+    usleep(COMMAND_GAP_US);
+    return 0;
+}
+
+// Both ports lead to a live pty
+static int portsUp(const t_runner *r)
+{
+    return access(r->txPort, F_OK) == 0 && access(r->rxPort, F_OK) == 0;
+}
+
+// The cable and its socat, when it won't quit
+static void killCable(t_runner *r)
+{
+    close(r->cableIn);
+    kill(-r->cablePid, SIGTERM);
+    double deadline = now() + 2;
+    while (waitpid(r->cablePid, NULL, WNOHANG) == 0 && now() < deadline)
+        usleep(50000);
+    kill(-r->cablePid, SIGKILL);
+    waitpid(r->cablePid, NULL, 0);
+}
+
+// The cable has its own process group, so ^C doesn't reach it
+static pid_t cableGroup;
+
+static void interrupted(int sig)
+{
+    if (cableGroup > 0)
+        kill(-cableGroup, SIGTERM);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// The cable's "Cable ready" stays in its stdio buffer when the output isn't
+// a terminal, so it's ready once both ports are there and it had the time to
+// open them
+static int startCable(t_runner *r)
+{
+    if (portsUp(r))
+    {
+        printf("%s and %s are already there, is another cable running?\n", r->txPort, r->rxPort);
+        return -1;
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0)
+        return -1;
+
+    char *argv[] = {(char *)r->cable, NULL};
+    r->cablePid = spawn(argv, NULL, r->cableLog, fds[0], 1);
+    close(fds[0]);
+    r->cableIn = fds[1];
+    if (r->cablePid < 0)
+        return close(fds[1]), -1;
+    cableGroup = r->cablePid;
+
+    double deadline = now() + CABLE_START_S;
+    while (!portsUp(r))
+    {
+        if (now() >= deadline || waitpid(r->cablePid, NULL, WNOHANG) != 0)
+            return killCable(r), -1;
+        usleep(100000);
+    }
+    usleep(CABLE_SETTLE_US);
+    if (waitpid(r->cablePid, NULL, WNOHANG) != 0)
+        return killCable(r), -1;
+    return 0;
+}
+
+static void stopCable(t_runner *r)
+{
+    cableCommand(r, "quit");
+    close(r->cableIn);
+    if (waitUntil(r->cablePid, now() + 5) < 0)
+    {
+        fprintf(stderr, "The cable didn't quit, killed it\n");
+        kill(-r->cablePid, SIGKILL);
+    }
+}
+
+////////////////////////////////////////////////
+// RUNS
+////////////////////////////////////////////////
+// Rows in the metrics file, not counting the header
+static long countRows(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    long lines = 0;
+    for (int c; file != NULL && (c = fgetc(file)) != EOF;)
+        lines += c == '\n';
+    if (file != NULL)
+        fclose(file);
+    return lines > 0 ? lines - 1 : 0;
+}
+
+// Reads the last row, which is the run's if the file has one row more than before it
+static int readMetrics(const t_runner *r, long rows, t_run *run)
+{
+    if (countRows(r->metrics) != rows + 1)
+        return -1;
+
+    FILE *file = fopen(r->metrics, "r");
+    if (file == NULL)
+        return -1;
+
+    char header[2048], row[2048] = "";
+    if (fgets(header, sizeof(header), file) == NULL)
+        return fclose(file), -1;
+    while (fgets(row, sizeof(row), file) != NULL)
+        ;
+    fclose(file);
+
+    run->elapsed = metricsColumn(header, row, "elapsed_s");
+    run->efficiency = metricsColumn(header, row, "efficiency");
+    run->frames = metricsColumn(header, row, "frames_sent");
+    run->retxTimeout = metricsColumn(header, row, "retx_timeout");
+    run->retxRej = metricsColumn(header, row, "retx_rej");
+    run->rttMedian = metricsColumn(header, row, "frame_rtt_us_p50");
+    return 0;
+}
+
+static t_run runOnce(const t_runner *r, int size)
+{
+    t_run run = {0};
+    long rows = countRows(r->metrics);
+    char baud[16], chunk[32], metrics[300];
+    snprintf(baud, sizeof(baud), "%d", r->baudRate);
+    snprintf(chunk, sizeof(chunk), "LL_CHUNK=%d", size);
+    snprintf(metrics, sizeof(metrics), "LL_METRICS=%s", r->metrics);
+
+    unlink(r->copy);
+    char *rxArgv[] = {(char *)r->program, (char *)r->rxPort, baud, "rx", (char *)r->copy, NULL};
+    const char *rxEnv[] = {"LL_METRICS", "LL_LOG=warn", NULL};
+    pid_t rx = spawn(rxArgv, rxEnv, NULL, -1, 0);
+    if (rx < 0)
+        return run;
+    usleep(RX_START_US);
+
+    char *txArgv[] = {(char *)r->program, (char *)r->txPort, baud, "tx", (char *)r->file, NULL};
+    const char *txEnv[] = {chunk, metrics, "LL_LOG=warn", NULL};
+    double deadline = now() + r->timeLimit;
+    pid_t tx = spawn(txArgv, txEnv, NULL, -1, 0);
+    int txStatus = tx < 0 ? -1 : waitUntil(tx, deadline);
+
+    // The receiver is done right after the transmitter, or never
+    waitUntil(rx, txStatus < 0 ? now() : now() + 5);
+
+    run.ok = txStatus >= 0 && sameFiles(r->file, r->copy) && readMetrics(r, rows, &run) == 0;
+    unlink(r->copy);
+    return run;
+}
+
+static void runPoint(t_runner *r, double value)
+{
+    double ber = r->sweep == SWEEP_BER ? value : r->ber;
+    double prop = r->sweep == SWEEP_PROP ? value : r->prop;
+    int size = r->sweep == SWEEP_SIZE ? (int)value : r->size;
+
+    // Both change the cable's buffers, so they're only sent between runs
+    cableCommand(r, "baud %d", r->baudRate);
+    cableCommand(r, "prop %lu", (unsigned long)prop);
+    cableCommand(r, "ber %g", ber);
+    usleep(SETTLE_US);
+
+    int ok = 0;
+    double sum = 0, min = 0, max = 0, elapsed = 0, frames = 0, timeouts = 0, rejs = 0, rtt = 0;
+    for (int i = 0; i < r->repeats; i++)
+    {
+        fprintf(stderr, "%s=%g run %d/%d\n", sweepNames[r->sweep], value, i + 1, r->repeats);
+        t_run run = runOnce(r, size);
+        usleep(SETTLE_US);
+        if (!run.ok)
+        {
+            fprintf(stderr, "  failed\n");
+            continue;
+        }
+
+        min = ok == 0 || run.efficiency < min ? run.efficiency : min;
+        max = ok == 0 || run.efficiency > max ? run.efficiency : max;
+        sum += run.efficiency;
+        elapsed += run.elapsed;
+        frames += run.frames;
+        timeouts += run.retxTimeout;
+        rejs += run.retxRej;
+        rtt += run.rttMedian;
+        ok++;
+    }
+
+    double n = ok > 0 ? ok : 1;
+    printf("%s,%g,%g,%d,%d,%zu,%d,%d,%.3f,%.4f,%.4f,%.4f,%.4f,%.1f,%.1f,%.1f,%.0f\n", sweepNames[r->sweep], ber,
+           prop, size, r->baudRate, r->fileSize, r->repeats, ok, elapsed / n, sum / n, min, max,
+           theory(r, ber, prop, size), frames / n, timeouts / n, rejs / n, rtt / n);
+    fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-x ber|prop|size] [-v values] [-e ber] [-d prop us] [-s size] [-b baud] [-n repeats]\n"
+           "       [-f file] [-l time limit s] [-k metrics.csv] [-c cable] [-m main] [-T tx port] [-R rx port]\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    t_runner r = {.cable = "bin/cable", .program = "bin/main", .txPort = "/dev/ttyS10", .rxPort = "/dev/ttyS11",
+                  .file = "penguin.gif", .baudRate = 9600, .repeats = 3, .timeLimit = 120, .size = 496,
+                  .sweep = SWEEP_BER, .cableIn = -1};
+    const char *values = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "x:v:e:d:s:b:n:f:l:k:c:m:T:R:")) != -1)
+    {
+        int ok = 1;
+        switch (opt)
+        {
+        case 'x':
+            ok = parseSweep(&r.sweep, optarg) == 0;
+            break;
+        case 'v':
+            values = optarg;
+            break;
+        case 'e':
+            r.ber = atof(optarg);
+            break;
+        case 'd':
+            r.prop = atof(optarg);
+            break;
+        case 's':
+            r.size = atoi(optarg);
+            break;
+        case 'b':
+            r.baudRate = atoi(optarg);
+            break;
+        case 'n':
+            r.repeats = atoi(optarg);
+            break;
+        case 'f':
+            r.file = optarg;
+            break;
+        case 'l':
+            r.timeLimit = atoi(optarg);
+            break;
+        case 'k':
+            snprintf(r.metrics, sizeof(r.metrics), "%s", optarg);
+            r.keepMetrics = 1;
+            break;
+        case 'c':
+            r.cable = optarg;
+            break;
+        case 'm':
+            r.program = optarg;
+            break;
+        case 'T':
+            r.txPort = optarg;
+            break;
+        case 'R':
+            r.rxPort = optarg;
+            break;
+        default:
+            ok = 0;
+        }
+        if (!ok)
+            return usage(argv[0]), 1;
+    }
+
+    static const char *const defaults[] = {"0,1e-5,5e-5,1e-4,2e-4", "0,10000,50000,100000,250000",
+                                           "50,100,250,500,996"};
+    if (parseList(&r.values, values != NULL ? values : defaults[r.sweep]) < 0 || r.repeats <= 0 ||
+        r.baudRate <= 0 || r.size <= 0)
+        return usage(argv[0]), 1;
+
+    if (measureFile(&r) < 0)
+    {
+        printf("Couldn't read '%s'!\n", r.file);
+        return 1;
+    }
+
+    snprintf(r.copy, sizeof(r.copy), "/tmp/cablerun.%d.copy", (int)getpid());
+    snprintf(r.cableLog, sizeof(r.cableLog), "/tmp/cablerun.%d.cable", (int)getpid());
+    if (!r.keepMetrics)
+        snprintf(r.metrics, sizeof(r.metrics), "/tmp/cablerun.%d.csv", (int)getpid());
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, interrupted);
+    signal(SIGTERM, interrupted);
+    if (startCable(&r) < 0)
+    {
+        printf("Couldn't start the cable '%s', see %s\n", r.cable, r.cableLog);
+        return 1;
+    }
+    cableCommand(&r, "on");
+
+    printf("sweep,ber,prop_us,size,baud,file_bytes,runs,ok,elapsed_s,efficiency,efficiency_min,efficiency_max,"
+           "theory,frames,retx_timeout,retx_rej,rtt_p50_us\n");
+    for (int i = 0; i < r.values.count; i++)
+        runPoint(&r, r.values.values[i]);
+
+    stopCable(&r);
+    unlink(r.cableLog);
+    if (!r.keepMetrics)
+        unlink(r.metrics);
+    return 0;
+}
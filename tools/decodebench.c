@@ -0,0 +1,171 @@
+// Frame decoder throughput: runs a captured byte stream through frameDecode
+// in transport-sized spans and one byte at a time, and prints MB/s for both.
+//
+// Usage: decodebench [capture file]
+//
+// The capture holds the raw bytes as they came off the line, either as is or
+// as an LL_CAPTURE file, of which the bytes a receiver reads are taken.
+// Without one, a stream of I-frames with random payloads, RR answers and some
+// line noise is generated.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "frame_decoder.h"
+#include "link_ext.h"
+
+#define SPAN 4096
+#define N_FRAMES 20000
+#define NOISE_EVERY 500
+#define MIN_BYTES (256 * 1024 * 1024)
+
+typedef struct s_stream
+{
+    uint8_t *bytes;
+    size_t  size;
+    size_t  capacity;
+}   t_stream;
+
+static int append(t_stream *stream, const uint8_t *bytes, size_t size)
+{
+    if (stream->size + size > stream->capacity)
+    {
+        size_t capacity = stream->capacity ? stream->capacity : 1 << 20;
+        while (capacity < stream->size + size)
+            capacity *= 2;
+        uint8_t *bigger = realloc(stream->bytes, capacity);
+        if (bigger == NULL)
+            return -1;
+        stream->bytes = bigger;
+        stream->capacity = capacity;
+    }
+
+    memcpy(stream->bytes + stream->size, bytes, size);
+    stream->size += size;
+    return 0;
+}
+
+static int appendFrame(t_stream *stream, t_frame frame)
+{
+    size_t size = 0;
+    uint8_t *string = frameToString(&frame, &size);
+    if (string == NULL)
+        return -1;
+    int retv = append(stream, string, size);
+    free(string);
+    return retv;
+}
+
+static int generate(t_stream *stream)
+{
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    srand(42);
+
+    for (int i = 0; i < N_FRAMES; i++)
+    {
+        size_t size = 1 + rand() % MAX_PAYLOAD_SIZE;
+        for (size_t k = 0; k < size; k++)
+            payload[k] = rand();
+
+        t_frame_addr addr = ADDR_CHANNEL(ADDR_SEND, i % MAX_CHANNELS);
+        if (appendFrame(stream, newFrame(addr, INFO_CTRL(i & 1, 0), payload, size)) < 0 ||
+            appendFrame(stream, newSUFrame(addr, i & 1 ? CTRL_RR0 : CTRL_RR1)) < 0)
+            return -1;
+
+        // Garbage between frames, as a noisy line leaves it
+        if (i % NOISE_EVERY == 0 && append(stream, payload, 16) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int loadCapture(t_stream *stream, t_capture_reader *reader)
+{
+    static t_capture_record record;
+    t_capture_dir feed = captureFeedDir(&reader->header);
+    int retv;
+    while ((retv = captureNext(reader, &record)) > 0)
+        if (record.dir == feed && append(stream, record.bytes, record.size) < 0)
+        {
+            retv = -1;
+            break;
+        }
+
+    captureReaderClose(reader);
+    return retv;
+}
+
+static int load(t_stream *stream, const char *path)
+{
+    t_capture_reader reader;
+    if (captureReaderOpen(&reader, path) == 0)
+        return loadCapture(stream, &reader);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+
+    uint8_t buffer[SPAN];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        if (append(stream, buffer, n) < 0)
+            return fclose(file), -1;
+
+    return fclose(file);
+}
+
+// Decodes the stream over and over until MIN_BYTES went through
+static double run(const t_stream *stream, size_t span, size_t *frames, size_t *bytes)
+{
+    t_decoder decoder;
+    frameDecoderInit(&decoder);
+    *frames = *bytes = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (*bytes < MIN_BYTES)
+    {
+        for (size_t done = 0; done < stream->size; done += span)
+        {
+            const uint8_t *p = stream->bytes + done;
+            size_t size = stream->size - done < span ? stream->size - done : span;
+            t_decoded_frame frame;
+            while (frameDecode(&decoder, &p, &size, &frame))
+                (*frames)++;
+        }
+        *bytes += stream->size;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    t_stream stream = {0};
+
+    if ((argc > 1 ? load(&stream, argv[1]) : generate(&stream)) < 0 || stream.size == 0)
+    {
+        printf("Couldn't %s the capture!\n", argc > 1 ? "read" : "generate");
+        return 1;
+    }
+    printf("Capture: %zu bytes%s\n", stream.size, argc > 1 ? "" : " (generated)");
+
+    const size_t spans[] = {SPAN, 1};
+    for (size_t i = 0; i < sizeof(spans) / sizeof(spans[0]); i++)
+    {
+        size_t frames, bytes;
+        double seconds = run(&stream, spans[i], &frames, &bytes);
+        printf("  %4zu byte spans: %8.1f MB/s, %.0f frames/s\n", spans[i],
+               bytes / seconds / 1e6, frames / seconds);
+    }
+
+    free(stream.bytes);
+    return 0;
+}
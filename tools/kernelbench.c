@@ -0,0 +1,317 @@
+// Micro-benchmarks of the per-byte kernels every frame goes through: BCC2
+// and the stuffing count in newFrame, stuffing in frameToString, destuffing
+// and the BCC2 check in frameDecode, and the ultoua / uatoi conversions of
+// the control packets.
+//
+// Usage: kernelbench [kernel] [corpus]
+//
+// Each kernel is warmed up, then timed over SAMPLES samples of a few
+// milliseconds each; the table shows percentiles of the per-sample ns/byte
+// (ns/call for the conversions). Optional arguments keep only the kernels /
+// corpora whose name contains them.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame_decoder.h"
+#include "link_layer.h"
+#include "protocol.h"
+#include "utils.h"
+
+#define PAYLOAD MAX_PAYLOAD_SIZE
+#define SAMPLES 51
+#define SAMPLE_NS 2000000.0
+#define WARMUP_NS 50000000.0
+#define N_NUMBERS 1024
+
+typedef struct s_corpus
+{
+    const char  *name;
+    uint8_t     bytes[PAYLOAD];
+}   t_corpus;
+
+// One kernel over one corpus: does n runs, returns a value to keep it alive
+typedef uint64_t (*t_kernel_fn)(const t_corpus *corpus, size_t n);
+
+typedef struct s_kernel
+{
+    const char  *name;
+    t_kernel_fn run;
+    size_t      units;      // Bytes or calls per run
+    const char  *unit;
+}   t_kernel;
+
+static volatile uint64_t sink;
+static uint64_t numbers[3][N_NUMBERS];
+static uint8_t *numberStrings[3][N_NUMBERS];
+static size_t numberSet;
+
+static double nowNs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+////////////////////////////////////////////////
+// CORPORA
+////////////////////////////////////////////////
+static void fillRandom(uint8_t *bytes, uint64_t seed)
+{
+    for (size_t i = 0; i < PAYLOAD; i++)
+        bytes[i] = xorshift(&seed);
+}
+
+// Entropy-coded data after the markers: random, with every 0xFF followed by
+// the 0x00 JPEG stuffs after it
+static void fillJpeg(uint8_t *bytes)
+{
+    static const uint8_t header[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01,
+                                     0x01, 0x00, 0x00, 0x48, 0x00, 0x48, 0x00, 0x00, 0xFF, 0xDB, 0x00, 0x43};
+    uint64_t seed = 7;
+    memcpy(bytes, header, sizeof(header));
+    for (size_t i = sizeof(header); i < PAYLOAD; i++)
+    {
+        bytes[i] = xorshift(&seed);
+        if (bytes[i] == 0xFF && i + 1 < PAYLOAD)
+            bytes[++i] = 0x00;
+    }
+}
+
+// A colour table of smooth gradients, which walks through 0x7D / 0x7E, then
+// LZW data in 255 byte sub-blocks
+static void fillGif(uint8_t *bytes)
+{
+    static const uint8_t header[] = {'G', 'I', 'F', '8', '9', 'a', 0x40, 0x00, 0x40, 0x00, 0xF7, 0x00, 0x00};
+    uint64_t seed = 11;
+    size_t i = 0;
+    memcpy(bytes, header, sizeof(header));
+    i += sizeof(header);
+
+    for (int c = 0; c < 256 && i + 3 <= PAYLOAD / 2; c++)
+    {
+        bytes[i++] = c;
+        bytes[i++] = c / 2 + 0x40;
+        bytes[i++] = 0xFF - c;
+    }
+
+    for (size_t block = 0; i < PAYLOAD; i++, block++)
+        bytes[i] = block % 256 == 0 ? 0xFF : xorshift(&seed);
+}
+
+static t_corpus corpora[] = {{"random"}, {"zeros"}, {"flags"}, {"escapes"}, {"jpeg"}, {"gif"}};
+#define N_CORPORA (sizeof(corpora) / sizeof(corpora[0]))
+
+static void makeCorpora(void)
+{
+    fillRandom(corpora[0].bytes, 42);
+    memset(corpora[1].bytes, 0x00, PAYLOAD);
+    memset(corpora[2].bytes, FLAG, PAYLOAD);
+    memset(corpora[3].bytes, ESCAPE, PAYLOAD);
+    fillJpeg(corpora[4].bytes);
+    fillGif(corpora[5].bytes);
+}
+
+// Control packet numbers: sequence-like, 32 bit sizes and full 64 bit sizes
+static const char *const numberSets[] = {"small", "u32", "u64"};
+#define N_NUMBER_SETS (sizeof(numberSets) / sizeof(numberSets[0]))
+
+static int makeNumbers(void)
+{
+    uint64_t seed = 3;
+    for (size_t s = 0; s < N_NUMBER_SETS; s++)
+        for (size_t i = 0; i < N_NUMBERS; i++)
+        {
+            uint64_t x = xorshift(&seed);
+            numbers[s][i] = s == 0 ? x % 1000 : s == 1 ? (uint32_t)x : x;
+            numberStrings[s][i] = ultoua(numbers[s][i]);
+            if (numberStrings[s][i] == NULL)
+                return -1;
+        }
+    return 0;
+}
+
+////////////////////////////////////////////////
+// KERNELS
+////////////////////////////////////////////////
+static uint64_t runNewFrame(const t_corpus *corpus, size_t n)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        t_frame frame = newFrame(ADDR_SEND, CTRL_INFO0, (uint8_t *)corpus->bytes, PAYLOAD);
+        acc += frame.bcc2 + frame.bytesToStuff;
+    }
+    return acc;
+}
+
+static uint64_t runFrameToString(const t_corpus *corpus, size_t n)
+{
+    uint64_t acc = 0;
+    t_frame frame = newFrame(ADDR_SEND, CTRL_INFO0, (uint8_t *)corpus->bytes, PAYLOAD);
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t size = 0;
+        uint8_t *string = frameToString(&frame, &size);
+        acc += size + string[size / 2];
+        free(string);
+    }
+    return acc;
+}
+
+static uint64_t runFrameDecode(const t_corpus *corpus, size_t n)
+{
+    static uint8_t *string = NULL;
+    static size_t size = 0;
+    static const t_corpus *encoded = NULL;
+
+    // Encoded once per corpus, outside the timing
+    if (encoded != corpus)
+    {
+        free(string);
+        t_frame frame = newFrame(ADDR_SEND, CTRL_INFO0, (uint8_t *)corpus->bytes, PAYLOAD);
+        string = frameToString(&frame, &size);
+        encoded = corpus;
+    }
+
+    t_decoder decoder;
+    frameDecoderInit(&decoder);
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const uint8_t *p = string;
+        size_t left = size;
+        t_decoded_frame frame;
+        while (frameDecode(&decoder, &p, &left, &frame))
+            acc += frame.size + frame.valid;
+    }
+    return acc;
+}
+
+static uint64_t runUltoua(const t_corpus *corpus, size_t n)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint8_t *string = ultoua(numbers[numberSet][i % N_NUMBERS]);
+        acc += string[0];
+        free(string);
+    }
+    return acc;
+}
+
+static uint64_t runUatoi(const t_corpus *corpus, size_t n)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint8_t *string = numberStrings[numberSet][i % N_NUMBERS];
+        acc += uatoi(string, strlen((char *)string));
+    }
+    return acc;
+}
+
+static const t_kernel kernels[] = {
+    {"newFrame", runNewFrame, PAYLOAD, "byte"},
+    {"frameToString", runFrameToString, PAYLOAD, "byte"},
+    {"frameDecode", runFrameDecode, PAYLOAD, "byte"},
+    {"ultoua", runUltoua, 1, "call"},
+    {"uatoi", runUatoi, 1, "call"},
+};
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+////////////////////////////////////////////////
+// TIMING
+////////////////////////////////////////////////
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, double p)
+{
+    size_t i = (size_t)(p / 100 * (SAMPLES - 1) + 0.5);
+    return sorted[i];
+}
+
+static void measure(const t_kernel *kernel, const t_corpus *corpus, const char *corpusName)
+{
+    // Warm up the caches and find how many runs make a sample
+    size_t runs = 1;
+    double start = nowNs(), elapsed = 0;
+    while ((elapsed = nowNs() - start) < WARMUP_NS)
+    {
+        sink += kernel->run(corpus, runs);
+        if (runs < (1 << 24))
+            runs *= 2;
+    }
+
+    double t0 = nowNs();
+    sink += kernel->run(corpus, runs);
+    double once = nowNs() - t0;
+    runs = once > 0 ? runs * SAMPLE_NS / once : runs;
+    if (runs == 0)
+        runs = 1;
+
+    double samples[SAMPLES];
+    for (int s = 0; s < SAMPLES; s++)
+    {
+        t0 = nowNs();
+        sink += kernel->run(corpus, runs);
+        samples[s] = (nowNs() - t0) / (runs * kernel->units);
+    }
+    qsort(samples, SAMPLES, sizeof(double), compareDoubles);
+
+    double median = percentile(samples, 50);
+    printf("%-14s %-8s %9.3f %9.3f %9.3f %9.3f  ns/%s", kernel->name, corpusName, samples[0], median,
+           percentile(samples, 90), percentile(samples, 99), kernel->unit);
+    if (kernel->units > 1)
+        printf("  %8.1f MB/s", 1e3 / median);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *kernelFilter = argc > 1 ? argv[1] : "";
+    const char *corpusFilter = argc > 2 ? argv[2] : "";
+
+    makeCorpora();
+    if (makeNumbers() < 0)
+    {
+        printf("Couldn't allocate the numbers!\n");
+        return 1;
+    }
+
+    printf("%-14s %-8s %9s %9s %9s %9s\n", "kernel", "corpus", "min", "p50", "p90", "p99");
+    for (size_t k = 0; k < N_KERNELS; k++)
+    {
+        if (strstr(kernels[k].name, kernelFilter) == NULL)
+            continue;
+
+        if (kernels[k].units == 1)
+        {
+            for (numberSet = 0; numberSet < N_NUMBER_SETS; numberSet++)
+                if (strstr(numberSets[numberSet], corpusFilter) != NULL)
+                    measure(&kernels[k], NULL, numberSets[numberSet]);
+            continue;
+        }
+
+        for (size_t c = 0; c < N_CORPORA; c++)
+            if (strstr(corpora[c].name, corpusFilter) != NULL)
+                measure(&kernels[k], &corpora[c], corpora[c].name);
+    }
+
+    return 0;
+}
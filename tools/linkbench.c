@@ -0,0 +1,333 @@
+// End-to-end throughput benchmark: a transmitter and a receiver run in one
+// process over the simulated line of the in-memory transport, for every
+// combination of payload size, bit error rate and propagation delay. Prints
+// one CSV row per run.
+//
+// Usage: linkbench [-s file KB] [-r reverse KB] [-b baud] [-p payloads] [-e bers]
+//                  [-d delays ms] [-t timeout s] [-n tries] [-l time limit s]
+//
+// Lists are comma separated, e.g. linkbench -p 100,500,996 -e 0,1e-5 -d 0,20.
+// Every run is a child process, so a run that hangs is cut off after the
+// time limit and its row says so. -r makes it a duplex run: the receiver
+// sends a file of its own back at the same time, acknowledgements ride on
+// the I-frames going the other way and the run is only ok when both copies
+// are.
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link_ext.h"
+#include "link_layer.h"
+#include "metrics.h"
+#include "sweep.h"
+#include "transfer.h"
+
+
+typedef struct s_bench
+{
+    char    source[64];
+    char    copy[80];
+    size_t  fileSize;
+    char    reverse[64];    // Sent back by the receiver in a duplex run
+    char    reverseCopy[80];
+    size_t  reverseSize;
+    int     baudRate;
+    int     timeout;
+    int     nTries;
+    int     timeLimit;
+    t_list  payloads;
+    t_list  bers;
+    t_list  delays;
+}   t_bench;
+
+// What a run sends back to the parent
+typedef struct s_result
+{
+    int         ok;
+    double      elapsed;
+    size_t      frames;
+    size_t      retxTimeout;
+    size_t      retxRej;
+    size_t      retxDamaged;
+    size_t      retxRnr;
+    uint64_t    rttMedian;
+}   t_result;
+
+typedef struct s_receiver
+{
+    const char  *spec;
+    const t_bench *bench;
+    int         result;
+}   t_receiver;
+
+// The second direction of a duplex run, on the link of the thread that starts it
+typedef struct s_duplex
+{
+    t_link      *link;
+    const char  *path;
+    LinkLayerRole direction;
+    int         result;
+}   t_duplex;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int createSource(char *source, size_t sourceSize, char *copy, size_t copySize, size_t fileSize)
+{
+    snprintf(source, sourceSize, "/tmp/linkbench.XXXXXX");
+    int fd = mkstemp(source);
+    if (fd < 0)
+        return -1;
+    snprintf(copy, copySize, "%s.copy", source);
+
+    FILE *file = fdopen(fd, "wb");
+    uint64_t x = 88172645463325252ULL ^ fileSize;
+    for (size_t i = 0; file != NULL && i < fileSize; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        fputc(x & 0xFF, file);
+    }
+    return file != NULL ? fclose(file) : -1;
+}
+
+static int openLink(const char *spec, LinkLayerRole role, const t_bench *bench)
+{
+    LinkLayer params = {.role = role, .baudRate = bench->baudRate, .nRetransmissions = bench->nTries,
+                        .timeout = bench->timeout};
+    snprintf(params.serialPort, sizeof(params.serialPort), "%s", spec);
+    return llopen(params);
+}
+
+static void *duplexLoop(void *arg)
+{
+    t_duplex *duplex = arg;
+
+    lluse(duplex->link);
+    duplex->result = duplex->direction == LlTx ? sendFile(duplex->path) : receiveFiles(duplex->path);
+    return NULL;
+}
+
+// Starts the second direction of a duplex run, returns whether there is one
+static int startDuplex(const t_bench *bench, t_duplex *duplex, pthread_t *thread, LinkLayerRole role)
+{
+    duplex->link = llcurrent();
+    duplex->direction = role == LlRx ? LlTx : LlRx;
+    duplex->path = role == LlRx ? bench->reverse : bench->reverseCopy;
+    duplex->result = 0;
+    if (bench->reverseSize == 0)
+        return 0;
+    if (pthread_create(thread, NULL, duplexLoop, duplex) != 0)
+        return duplex->result = -1, 0;
+    return 1;
+}
+
+static void *receiver(void *arg)
+{
+    t_receiver *rx = arg;
+
+    rx->result = -1;
+    if (openLink(rx->spec, LlRx, rx->bench) < 0)
+        return NULL;
+
+    t_duplex duplex;
+    pthread_t thread;
+    int started = startDuplex(rx->bench, &duplex, &thread, LlRx);
+    rx->result = receiveFiles(rx->bench->copy);
+    if (started)
+        pthread_join(thread, NULL);
+    rx->result = rx->result < 0 ? rx->result : duplex.result;
+    llclose(FALSE);
+    return NULL;
+}
+
+// Runs in the child: both ends of one transfer
+static t_result runOnce(const t_bench *bench, const char *spec)
+{
+    t_result result = {0};
+    t_receiver rx = {spec, bench, -1};
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, receiver, &rx) != 0)
+        return result;
+
+    double start = now();
+    int txResult = -1;
+    if (openLink(spec, LlTx, bench) >= 0)
+    {
+        t_duplex duplex;
+        pthread_t reverse;
+        int started = startDuplex(bench, &duplex, &reverse, LlTx);
+        txResult = sendFile(bench->source);
+        if (started)
+            pthread_join(reverse, NULL);
+        txResult = txResult < 0 ? txResult : duplex.result;
+        result.elapsed = now() - start;
+
+        const t_metrics *m = llmetrics();
+        result.frames = m->framesSent;
+        result.retxTimeout = m->retxTimeout;
+        result.retxRej = m->retxRej;
+        result.retxDamaged = m->retxDamaged;
+        result.retxRnr = m->retxRnr;
+        result.rttMedian = histPercentile(&m->frameRtt, 50);
+        llclose(FALSE);
+    }
+    pthread_join(thread, NULL);
+
+    result.ok = txResult == 0 && rx.result == 0;
+    return result;
+}
+
+// Forks the run, its output goes nowhere and its result comes back through a pipe
+static int runCase(const t_bench *bench, int payload, double ber, double delay, int seed, t_result *result)
+{
+    // Each run has a process of its own, so every one can use the same name
+    char spec[sizeof(((LinkLayer *)0)->serialPort)];
+    if (snprintf(spec, sizeof(spec), "mem:b,baud=%d,delay=%g,ber=%g,seed=%d", bench->baudRate, delay, ber, seed) >=
+        (int)sizeof(spec))
+        return -1;
+
+    int fds[2];
+    if (pipe(fds) < 0)
+        return -1;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        return close(fds[0]), close(fds[1]), -1;
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+        if (freopen("/dev/null", "w", stdout) == NULL)
+            _exit(1);
+
+        char chunk[16];
+        snprintf(chunk, sizeof(chunk), "%d", payload);
+        setenv("LL_CHUNK", chunk, 1);
+        setenv("LL_LOG", "off", 1);
+        // Delayed acknowledgements come with duplex mode, as they do for bin/main
+        if (bench->reverseSize > 0)
+            setenv("LL_DUPLEX_SEND", bench->reverse, 1);
+        alarm(bench->timeLimit);
+
+        t_result r = runOnce(bench, spec);
+        _exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t bytes = read(fds[0], result, sizeof(*result));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    unlink(bench->copy);
+    unlink(bench->reverseCopy);
+    return bytes == sizeof(*result) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    t_bench bench = {.fileSize = 16 * 1024, .baudRate = 115200, .timeout = 1, .nTries = 10, .timeLimit = 120};
+    parseList(&bench.payloads, "100,250,500,996");
+    parseList(&bench.bers, "0,1e-5,1e-4");
+    parseList(&bench.delays, "0,10");
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:b:p:e:d:t:n:l:")) != -1)
+    {
+        int ok = 1;
+        switch (opt)
+        {
+        case 's':
+            bench.fileSize = strtoul(optarg, NULL, 10) * 1024;
+            break;
+        case 'r':
+            bench.reverseSize = strtoul(optarg, NULL, 10) * 1024;
+            break;
+        case 'b':
+            bench.baudRate = atoi(optarg);
+            break;
+        case 'p':
+            ok = parseList(&bench.payloads, optarg) == 0;
+            break;
+        case 'e':
+            ok = parseList(&bench.bers, optarg) == 0;
+            break;
+        case 'd':
+            ok = parseList(&bench.delays, optarg) == 0;
+            break;
+        case 't':
+            bench.timeout = atoi(optarg);
+            break;
+        case 'n':
+            bench.nTries = atoi(optarg);
+            break;
+        case 'l':
+            bench.timeLimit = atoi(optarg);
+            break;
+        default:
+            ok = 0;
+        }
+        if (!ok)
+        {
+            printf("Usage: %s [-s file KB] [-r reverse KB] [-b baud] [-p payloads] [-e bers] [-d delays ms] "
+                   "[-t timeout s] [-n tries] [-l time limit s]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (bench.fileSize == 0 ||
+        createSource(bench.source, sizeof(bench.source), bench.copy, sizeof(bench.copy), bench.fileSize) < 0 ||
+        (bench.reverseSize > 0 && createSource(bench.reverse, sizeof(bench.reverse), bench.reverseCopy,
+                                               sizeof(bench.reverseCopy), bench.reverseSize) < 0))
+    {
+        perror("Couldn't create the source file");
+        unlink(bench.source);
+        return 1;
+    }
+
+    printf("payload,ber,delay_ms,baud,file_bytes,reverse_bytes,elapsed_s,goodput_bps,efficiency,frames,"
+           "retx_timeout,retx_rej,retx_damaged,retx_rnr,rtt_p50_us,ok\n");
+
+    int seed = 0, failed = 0;
+    for (int p = 0; p < bench.payloads.count; p++)
+        for (int e = 0; e < bench.bers.count; e++)
+            for (int d = 0; d < bench.delays.count; d++)
+            {
+                int payload = bench.payloads.values[p];
+                double ber = bench.bers.values[e];
+                double delay = bench.delays.values[d];
+
+                t_result r = {0};
+                if (runCase(&bench, payload, ber, delay, ++seed, &r) < 0)
+                    r.ok = 0;
+
+                double goodput = r.ok && r.elapsed > 0 ? bench.fileSize * 8 / r.elapsed : 0;
+                printf("%d,%g,%g,%d,%zu,%zu,%.3f,%.0f,%.4f,%zu,%zu,%zu,%zu,%zu,%" PRIu64 ",%d\n", payload, ber,
+                       delay, bench.baudRate, bench.fileSize, bench.reverseSize, r.elapsed, goodput,
+                       bench.baudRate > 0 ? goodput / bench.baudRate : 0, r.frames, r.retxTimeout, r.retxRej,
+                       r.retxDamaged, r.retxRnr, r.rttMedian, r.ok);
+                fflush(stdout);
+                failed += !r.ok;
+            }
+
+    unlink(bench.source);
+    if (bench.reverseSize > 0)
+        unlink(bench.reverse);
+    return failed > 0;
+}
@@ -0,0 +1,460 @@
+// Link daemon: keeps one link open and runs file transfer jobs submitted by
+// local clients over a UNIX-domain socket, without a new handshake per job.
+//
+// Daemon: linkd /dev/ttySxx baudrate tx|rx <control socket> [spool dir]
+// Client: linkd -c <control socket> send <file> | recv <file> | status | quit
+//
+// Received files are written to the spool directory (default "."); a recv job
+// takes the next file that arrives and moves it to the given path.
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "link_ext.h"
+#include "link_layer.h"
+#include "transfer.h"
+
+#define N_TRIES 3
+#define TIMEOUT 4
+#define DEFAULT_KEEPALIVE_S 10
+#define LINE_SIZE (PATH_MAX + 16)
+
+typedef enum
+{
+    JOB_SEND,
+    JOB_RECV
+}   t_job_type;
+
+typedef struct s_job
+{
+    t_job_type      type;
+    char            path[PATH_MAX];
+    int             done;
+    int             result;
+    struct s_job    *next;
+}   t_job;
+
+typedef struct s_daemon
+{
+    t_link          *link;
+    LinkLayerRole   role;
+    const char      *spool;
+    int             keepalive;
+    int             running;
+    int             linkUp;
+    int             listenFd;
+
+    t_job           *sendJobs;
+    t_job           *recvJobs;
+    size_t          jobsDone;
+    size_t          jobsFailed;
+    size_t          filesSpooled;
+    size_t          keepalives;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+}   t_daemon;
+
+static t_daemon linkd = {
+    .running = TRUE,
+    .linkUp = TRUE,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER};
+
+static void pushJob(t_job **queue, t_job *job)
+{
+    while (*queue != NULL)
+        queue = &(*queue)->next;
+    *queue = job;
+}
+
+// Takes a job out of its queue, FALSE if a link thread already took it
+static int removeJob(t_job **queue, t_job *job)
+{
+    for (; *queue != NULL; queue = &(*queue)->next)
+        if (*queue == job)
+            return *queue = job->next, TRUE;
+    return FALSE;
+}
+
+// Called with the lock held
+static void finishJob(t_job *job, int result)
+{
+    job->done = TRUE;
+    job->result = result;
+    if (result == 0)
+        linkd.jobsDone++;
+    else
+        linkd.jobsFailed++;
+    pthread_cond_broadcast(&linkd.cond);
+}
+
+////////////////////////////////////////////////
+// LINK THREADS
+////////////////////////////////////////////////
+// Sends queued files back to back, or interleaved over logical channels when
+// LL_MUX is set, and keeps the link alive while idle.
+static void *senderLoop(void *arg)
+{
+    const t_config *config = getConfig();
+    lluse(linkd.link);
+
+    pthread_mutex_lock(&linkd.lock);
+    while (linkd.running)
+    {
+        if (linkd.sendJobs == NULL)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += linkd.keepalive;
+
+            while (linkd.running && linkd.sendJobs == NULL)
+                if (pthread_cond_timedwait(&linkd.cond, &linkd.lock, &deadline) == ETIMEDOUT)
+                    break;
+
+            if (!linkd.running || linkd.sendJobs != NULL || linkd.role != LlTx)
+                continue;
+
+            pthread_mutex_unlock(&linkd.lock);
+            int retv = linkd.linkUp ? sendKeepalive() : llreset();
+            pthread_mutex_lock(&linkd.lock);
+
+            linkd.keepalives++;
+            if (retv < 0 && linkd.linkUp)
+                printf("[linkd] Link down, reconnecting every %d seconds\n", linkd.keepalive);
+            if (retv == 0 && !linkd.linkUp)
+                printf("[linkd] Link up again\n");
+            linkd.linkUp = retv == 0;
+            pthread_cond_broadcast(&linkd.cond);
+            continue;
+        }
+
+        t_job *jobs[MAX_CHANNELS - 1];
+        char *names[MAX_CHANNELS - 1];
+        int count = 0;
+        int max = config->mux ? MAX_CHANNELS - 1 : 1;
+
+        while (linkd.sendJobs != NULL && count < max)
+        {
+            jobs[count] = linkd.sendJobs;
+            names[count] = jobs[count]->path;
+            linkd.sendJobs = jobs[count]->next;
+            count++;
+        }
+
+        pthread_mutex_unlock(&linkd.lock);
+        int retv = config->mux ? sendFilesMux(names, count, config->muxPolicy) : sendFile(names[0]);
+        // A job is only done once its last packets left the aggregation buffer
+        if (retv == 0)
+            retv = llflush();
+        pthread_mutex_lock(&linkd.lock);
+
+        for (int i = 0; i < count; i++)
+            finishJob(jobs[i], retv);
+        if (retv < 0 && linkd.role == LlTx)
+            linkd.linkUp = FALSE;
+    }
+    pthread_mutex_unlock(&linkd.lock);
+
+    return NULL;
+}
+
+static void onFileReceived(const char *path, int ok, void *arg)
+{
+    pthread_mutex_lock(&linkd.lock);
+
+    t_job *job = linkd.recvJobs;
+    if (job == NULL)
+    {
+        linkd.filesSpooled++;
+        pthread_mutex_unlock(&linkd.lock);
+        return;
+    }
+
+    linkd.recvJobs = job->next;
+    if (ok && rename(path, job->path) < 0)
+    {
+        perror(job->path);
+        ok = FALSE;
+    }
+    finishJob(job, ok ? 0 : -1);
+
+    pthread_mutex_unlock(&linkd.lock);
+}
+
+static void *receiverLoop(void *arg)
+{
+    lluse(linkd.link);
+
+    while (linkd.running)
+    {
+        if (!llclosing())
+        {
+            receiveFilesHook(linkd.spool, onFileReceived, NULL);
+            continue;
+        }
+        if (linkd.role == LlRx)
+            break;
+
+        // The transmitter's line failed, its sender brings it back with llreset
+        pthread_mutex_lock(&linkd.lock);
+        if (linkd.linkUp)
+            printf("[linkd] Link down, reconnecting every %d seconds\n", linkd.keepalive);
+        linkd.linkUp = FALSE;
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += linkd.keepalive;
+        while (linkd.running && !linkd.linkUp)
+            if (pthread_cond_timedwait(&linkd.cond, &linkd.lock, &deadline) == ETIMEDOUT)
+                break;
+        pthread_mutex_unlock(&linkd.lock);
+    }
+
+    // The transmitter disconnected: the receiver daemon follows it
+    pthread_mutex_lock(&linkd.lock);
+    if (linkd.running)
+    {
+        linkd.running = FALSE;
+        shutdown(linkd.listenFd, SHUT_RDWR);
+    }
+    pthread_cond_broadcast(&linkd.cond);
+    pthread_mutex_unlock(&linkd.lock);
+
+    return NULL;
+}
+
+////////////////////////////////////////////////
+// CLIENTS
+////////////////////////////////////////////////
+static void reply(int fd, const char *fmt, const char *arg)
+{
+    char line[LINE_SIZE + 64];
+    int size = snprintf(line, sizeof(line), fmt, arg);
+    write(fd, line, size);
+}
+
+static void runJob(int fd, t_job_type type, const char *path)
+{
+    t_job *job = calloc(1, sizeof(t_job));
+    if (job == NULL)
+        return reply(fd, "error %s\n", "out of memory");
+
+    job->type = type;
+    snprintf(job->path, sizeof(job->path), "%s", path);
+
+    pthread_mutex_lock(&linkd.lock);
+    pushJob(type == JOB_SEND ? &linkd.sendJobs : &linkd.recvJobs, job);
+    pthread_cond_broadcast(&linkd.cond);
+
+    // Once the daemon stops, a job still queued is dropped, one a link thread
+    // took is waited for
+    t_job **queue = type == JOB_SEND ? &linkd.sendJobs : &linkd.recvJobs;
+    while (!job->done && (linkd.running || !removeJob(queue, job)))
+        pthread_cond_wait(&linkd.cond, &linkd.lock);
+
+    int done = job->done;
+    int result = job->result;
+    free(job);
+    pthread_mutex_unlock(&linkd.lock);
+
+    if (!done)
+        reply(fd, "error %s\n", "daemon stopped");
+    else if (result < 0)
+        reply(fd, "error %s failed\n", path);
+    else
+        reply(fd, type == JOB_SEND ? "ok sent %s\n" : "ok received %s\n", path);
+}
+
+static void *clientLoop(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    char line[LINE_SIZE] = {0};
+
+    // A command may come in several reads, it ends with a newline or EOF
+    size_t size = 0;
+    int retv;
+    while (size < sizeof(line) - 1 && memchr(line, '\n', size) == NULL &&
+           (retv = read(fd, line + size, sizeof(line) - 1 - size)) > 0)
+        size += retv;
+
+    if (size > 0)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (strncmp(line, "send ", 5) == 0)
+            runJob(fd, JOB_SEND, line + 5);
+        else if (strncmp(line, "recv ", 5) == 0)
+            runJob(fd, JOB_RECV, line + 5);
+        else if (strcmp(line, "status") == 0)
+        {
+            char status[256];
+            pthread_mutex_lock(&linkd.lock);
+            snprintf(status, sizeof(status),
+                     "link %s, %zu jobs done, %zu failed, %zu files spooled, %zu keepalives",
+                     linkd.linkUp ? "up" : "down", linkd.jobsDone, linkd.jobsFailed,
+                     linkd.filesSpooled, linkd.keepalives);
+            pthread_mutex_unlock(&linkd.lock);
+            reply(fd, "ok %s\n", status);
+        }
+        else if (strcmp(line, "quit") == 0 && linkd.role == LlRx)
+            reply(fd, "error %s\n", "quit the transmitter daemon, the receiver follows it");
+        else if (strcmp(line, "quit") == 0)
+        {
+            pthread_mutex_lock(&linkd.lock);
+            linkd.running = FALSE;
+            shutdown(linkd.listenFd, SHUT_RDWR);
+            pthread_cond_broadcast(&linkd.cond);
+            pthread_mutex_unlock(&linkd.lock);
+            reply(fd, "ok %s\n", "closing link");
+        }
+        else
+            reply(fd, "error unknown command '%s'\n", line);
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static int openControlSocket(const char *path, int listening)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Control socket path is too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return perror("socket"), -1;
+
+    if (!listening)
+    {
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            return perror(path), close(fd), -1;
+        return fd;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+        return perror(path), close(fd), -1;
+    return fd;
+}
+
+static int runClient(const char *socketPath, int argc, char *argv[])
+{
+    char line[LINE_SIZE] = {0};
+    for (int i = 0; i < argc; i++)
+    {
+        strncat(line, argv[i], sizeof(line) - strlen(line) - 2);
+        strcat(line, i + 1 < argc ? " " : "\n");
+    }
+
+    int fd = openControlSocket(socketPath, FALSE);
+    if (fd < 0)
+        return 1;
+
+    write(fd, line, strlen(line));
+
+    char answer[LINE_SIZE + 64] = {0};
+    size_t size = 0;
+    int retv = 0;
+    while (size < sizeof(answer) - 1 && (retv = read(fd, answer + size, sizeof(answer) - 1 - size)) > 0)
+        size += retv;
+    close(fd);
+
+    printf("%s", answer);
+    return strncmp(answer, "ok", 2) == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 4 && strcmp(argv[1], "-c") == 0)
+        return runClient(argv[2], argc - 3, argv + 3);
+
+    if (argc < 5)
+    {
+        printf("Usage: %s /dev/ttySxx baudrate tx|rx <control socket> [spool dir]\n"
+               "       %s -c <control socket> send <file> | recv <file> | status | quit\n",
+               argv[0], argv[0]);
+        exit(1);
+    }
+
+    if (strcmp("tx", argv[3]) != 0 && strcmp("rx", argv[3]) != 0)
+    {
+        printf("ERROR: Role must be \"tx\" or \"rx\"\n");
+        exit(3);
+    }
+
+    LinkLayer connectionParameters;
+    snprintf(connectionParameters.serialPort, sizeof(connectionParameters.serialPort), "%s", argv[1]);
+    connectionParameters.role = strcmp(argv[3], "tx") ? LlRx : LlTx;
+    connectionParameters.baudRate = atoi(argv[2]);
+    connectionParameters.nRetransmissions = N_TRIES;
+    connectionParameters.timeout = TIMEOUT;
+
+    const char *keepalive = getenv("LL_KEEPALIVE_S");
+    linkd.keepalive = keepalive != NULL && atoi(keepalive) > 0 ? atoi(keepalive) : DEFAULT_KEEPALIVE_S;
+    linkd.role = connectionParameters.role;
+    linkd.spool = argc > 5 ? argv[5] : ".";
+
+    linkd.listenFd = openControlSocket(argv[4], TRUE);
+    if (linkd.listenFd < 0)
+        exit(1);
+
+    if (llopen(connectionParameters) < 0)
+    {
+        printf("Error trying to start connection!\n");
+        llclose(FALSE);
+        unlink(argv[4]);
+        exit(1);
+    }
+
+    linkd.link = llcurrent();
+    printf("[linkd] Link open, accepting jobs on %s\n", argv[4]);
+
+    pthread_t sender, receiver;
+    pthread_create(&sender, NULL, senderLoop, NULL);
+    pthread_create(&receiver, NULL, receiverLoop, NULL);
+
+    while (linkd.running)
+    {
+        int fd = accept(linkd.listenFd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        pthread_t client;
+        if (pthread_create(&client, NULL, clientLoop, (void *)(intptr_t)fd) != 0)
+            close(fd);
+        else
+            pthread_detach(client);
+    }
+
+    pthread_mutex_lock(&linkd.lock);
+    linkd.running = FALSE;
+    pthread_cond_broadcast(&linkd.cond);
+    pthread_mutex_unlock(&linkd.lock);
+
+    pthread_join(sender, NULL);
+    int retv = llclose(TRUE);
+    pthread_join(receiver, NULL);
+
+    close(linkd.listenFd);
+    unlink(argv[4]);
+    return retv < 0 ? 1 : 0;
+}
@@ -0,0 +1,146 @@
+// Follows the live counters a transfer started with LL_TELEMETRY=<name>
+// publishes in shared memory. Reading never slows the transfer down.
+//
+// Usage: linkstat <name> [interval ms]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link_layer.h"
+#include "telemetry.h"
+
+#define DEFAULT_INTERVAL_MS 500
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void printEta(int seconds)
+{
+    if (seconds < 0)
+        printf("--:--");
+    else if (seconds >= 3600)
+        printf("%d:%02d:%02d", seconds / 3600, seconds / 60 % 60, seconds % 60);
+    else
+        printf("%02d:%02d", seconds / 60, seconds % 60);
+}
+
+// One line per sample, rewritten in place on a terminal
+static void printSample(const t_telemetry *t, double rate, int tty)
+{
+    if (tty)
+        fputs("\r\033[K", stdout);
+    printf("%s ", t->role == LlTx ? "tx" : "rx");
+
+    if (t->fileName[0] != '\0')
+    {
+        if (t->fileSize > 0)
+            printf("'%s' %" PRIu64 "/%" PRIu64 " (%.1f%%) eta ", t->fileName, t->fileDone, t->fileSize,
+                   100.0 * t->fileDone / t->fileSize);
+        else
+            printf("'%s' %" PRIu64 " eta ", t->fileName, t->fileDone);
+        printEta(t->etaSeconds);
+        printf(" | ");
+    }
+
+    printf("%.0f B/s, %" PRIu64 " B, srtt %.3f ms, rto %" PRIu32 " ms, window %" PRIu32 "/%" PRIu32,
+           rate, t->payload, t->srttUs / 1000.0, t->rtoMs, t->windowUsed, t->windowSize);
+    if (t->aggregated > 0)
+        printf(" +%" PRIu32 " B held", t->aggregated);
+    if (t->role == LlRx)
+        printf(", queue %" PRIu32 "/%" PRIu32, t->rxQueued, t->rxQueueSize);
+    printf(", frames %" PRIu64 "/%" PRIu64 ", retx %" PRIu64 ", errors %" PRIu64,
+           t->framesSent, t->framesReceived, t->retransmits, t->errors);
+    if (t->filesDone > 1)
+        printf(", %" PRIu32 " files", t->filesDone);
+
+    if (!tty)
+        fputs("\n", stdout);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <name> [interval ms]\n", argv[0]);
+        return 1;
+    }
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s%s", argv[1][0] == '/' ? "" : "/", argv[1]);
+    int interval = argc > 2 ? atoi(argv[2]) : DEFAULT_INTERVAL_MS;
+    if (interval <= 0)
+        interval = DEFAULT_INTERVAL_MS;
+
+    // The transfer may not have started yet
+    int fd;
+    while ((fd = shm_open(name, O_RDONLY, 0)) < 0 && errno == ENOENT)
+        usleep(interval * 1000);
+    if (fd < 0)
+    {
+        printf("Couldn't open '%s'!\n", name);
+        return 1;
+    }
+
+    const t_telemetry *shared = mmap(NULL, sizeof(t_telemetry), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED)
+    {
+        printf("Couldn't map '%s'!\n", name);
+        return 1;
+    }
+
+    while (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC)
+        usleep(interval * 1000);
+    if (shared->version != TELEMETRY_VERSION)
+    {
+        printf("'%s' has telemetry version %" PRIu32 ", expected %d!\n", name, shared->version, TELEMETRY_VERSION);
+        return 1;
+    }
+
+    int tty = isatty(STDOUT_FILENO);
+    t_telemetry t, last = {0};
+    double lastTime = 0;
+    double rate = 0;
+
+    // Until the link closes or the process that published it is gone
+    while (1)
+    {
+        if (telemetrySnapshot(shared, &t) == 0)
+        {
+            double time = now();
+            if (lastTime > 0 && time > lastTime && t.payload >= last.payload)
+                rate = (t.payload - last.payload) / (time - lastTime);
+            last = t;
+            lastTime = time;
+
+            printSample(&t, rate, tty);
+            if (t.state == TM_CLOSED)
+                break;
+        }
+
+        if (kill(shared->pid, 0) < 0 && errno == ESRCH)
+            break;
+        usleep(interval * 1000);
+    }
+
+    if (tty)
+        printf("\n");
+    double elapsed = last.updated - last.start;
+    if (elapsed > 0)
+        printf("Link %s: %" PRIu64 " payload bytes in %.3f s, %.0f B/s on average\n",
+               last.state == TM_CLOSED ? "closed" : "gone", last.payload, elapsed, last.payload / elapsed);
+    return 0;
+}
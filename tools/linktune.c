@@ -0,0 +1,295 @@
+// Recommends link settings for a line from the analytic model of
+// link_model.h: the file data per packet (LL_CHUNK) with the best goodput,
+// a timeout (LL_TIMEOUT_MS) above the round trip, and enough retransmissions
+// (LL_RETRIES) that a whole file is unlikely to fail. The line is given, or
+// measured from the LL_METRICS row of an earlier transfer; the stuffing comes
+// from a sample of the file to send.
+//
+// Usage: linktune [-m metrics.csv] [-b baud] [-d prop ms] [-e ber] [-f file]
+//                 [-s file bytes] [-w tuning file]
+//
+// Options are applied in order, so the ones after -m override what it
+// measured. -w writes the settings for LL_TUNE=<file>, which makes llopen use
+// them instead of the ones main.c gives it. The link runs stop-and-wait: the
+// window that would fill the line and what go-back-N or selective repeat
+// would get out of it are only shown for comparison.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "link_layer.h"
+#include "link_model.h"
+#include "metrics.h"
+#include "protocol.h"
+
+#define PACKET_HEADER 4             // Of a data packet, in front of the file data
+#define MIN_CHUNK 16
+#define MAX_CHUNK (MAX_PAYLOAD_SIZE - PACKET_HEADER)
+#define DEFAULT_CHUNK (MAX_PAYLOAD_SIZE / 2)    // Without LL_CHUNK
+#define SAMPLE_BLOCKS 16
+#define SAMPLE_BLOCK 4096
+#define RANDOM_STUFFING (2.0 / 256) // FLAG and ESCAPE in uniform data
+#define TIMEOUT_FACTOR 2            // Round trips, for the jitter of a loaded machine
+#define TIMEOUT_MARGIN 0.05         // Seconds of scheduling on both ends
+#define TIMEOUT_STEP 0.01
+#define TIMEOUT_MIN 0.1
+#define FILE_FAILURE 1e-6           // Acceptable odds that a frame runs out of retries
+#define MAX_RETRIES 30
+#define DEFAULT_FILE_SIZE (1024 * 1024)
+
+typedef struct s_tune
+{
+    t_line      line;
+    double      fileSize;
+    const char  *stuffingFrom;  // Where the stuffing ratio came from
+}   t_tune;
+
+typedef struct s_settings
+{
+    int     chunk;
+    double  efficiency;
+    double  timeout;
+    int     retries;
+    int     window;     // That would fill the line
+}   t_settings;
+
+////////////////////////////////////////////////
+// INPUTS
+////////////////////////////////////////////////
+// Escape bytes per byte over blocks spread through the file
+static int sampleFile(t_tune *tune, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+    if (fseek(file, 0, SEEK_END) < 0)
+        return fclose(file), -1;
+
+    long size = ftell(file);
+    uint8_t block[SAMPLE_BLOCK];
+    size_t sampled = 0, special = 0;
+    for (int i = 0; i < SAMPLE_BLOCKS && size > 0; i++)
+    {
+        long offset = size > SAMPLE_BLOCK ? (size - SAMPLE_BLOCK) / (SAMPLE_BLOCKS - 1) * i : 0;
+        if (fseek(file, offset, SEEK_SET) < 0)
+            break;
+        size_t n = fread(block, 1, sizeof(block), file);
+        for (size_t k = 0; k < n; k++)
+            special += block[k] == FLAG || block[k] == ESCAPE;
+        sampled += n;
+        if (size <= SAMPLE_BLOCK)
+            break;
+    }
+    fclose(file);
+
+    if (sampled == 0)
+        return -1;
+    tune->line.stuffing = (double)special / sampled;
+    tune->fileSize = size;
+    tune->stuffingFrom = "sampled";
+    return 0;
+}
+
+// The line as the transmitter's last llclose saw it: frames that needed
+// another try give the frame error rate, and the median round trip less the
+// time on the line gives the propagation delay
+static int measure(t_tune *tune, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    char header[2048], row[2048] = "", last[2048] = "";
+    if (fgets(header, sizeof(header), file) == NULL)
+        return fclose(file), -1;
+    while (fgets(row, sizeof(row), file) != NULL)
+        if (strstr(row, ",tx,") != NULL)
+            memcpy(last, row, sizeof(last));
+    fclose(file);
+    if (last[0] == '\0')
+    {
+        printf("'%s' has no transmitter row!\n", path);
+        return -1;
+    }
+
+    double frames = metricsColumn(header, last, "frames_sent");
+    double retries = metricsColumn(header, last, "retx_timeout") + metricsColumn(header, last, "retx_rej") +
+                     metricsColumn(header, last, "retx_damaged");
+    double payload = metricsColumn(header, last, "payload_bytes");
+    double rtt = metricsColumn(header, last, "frame_rtt_us_p50") / 1e6;
+    if (frames <= retries || payload <= 0)
+    {
+        printf("'%s' has no frames to measure!\n", path);
+        return -1;
+    }
+
+    t_line *line = &tune->line;
+    line->baudRate = metricsColumn(header, last, "line_rate_bps");
+    line->stuffing = metricsColumn(header, last, "stuffing_ratio");
+    tune->stuffingFrom = "measured";
+    size_t size = payload / (frames - retries) + 0.5;
+    line->ber = modelBer(retries / frames, size, line->stuffing);
+    double prop = (rtt - modelFrameTime(line, size) - modelAnswerTime(line)) / 2;
+    line->prop = prop > 0 ? prop : 0;
+
+    printf("Measured on %.0f frames of %zu bytes: %d baud, %.0f%% tries failed (ber %.2g), "
+           "round trip %.1f ms (%.1f ms propagation)\n", frames, size, line->baudRate, 100 * retries / frames,
+           line->ber, rtt * 1000, line->prop * 1000);
+    return 0;
+}
+
+////////////////////////////////////////////////
+// MODEL
+////////////////////////////////////////////////
+static double fileEfficiency(const t_line *line, int chunk, t_arq arq, int window)
+{
+    return modelEfficiency(line, chunk + PACKET_HEADER, arq, window) * chunk / (chunk + PACKET_HEADER);
+}
+
+static int fillingWindow(const t_line *line, int chunk)
+{
+    double k = modelCycle(line, chunk + PACKET_HEADER);
+    int window = (int)k;
+    return window < k ? window + 1 : window;
+}
+
+static t_settings recommend(const t_tune *tune)
+{
+    const t_line *line = &tune->line;
+    t_settings best = {0};
+    for (int chunk = MIN_CHUNK; chunk <= MAX_CHUNK; chunk++)
+    {
+        double efficiency = fileEfficiency(line, chunk, ARQ_STOP_AND_WAIT, 1);
+        if (efficiency > best.efficiency)
+        {
+            best.chunk = chunk;
+            best.efficiency = efficiency;
+        }
+    }
+
+    size_t payload = best.chunk + PACKET_HEADER;
+    double roundTrip = modelFrameTime(line, payload) + modelAnswerTime(line) + 2 * line->prop;
+    double timeout = TIMEOUT_FACTOR * roundTrip + TIMEOUT_MARGIN;
+    timeout = (int)(timeout / TIMEOUT_STEP + 0.999) * TIMEOUT_STEP;
+    best.timeout = timeout > TIMEOUT_MIN ? timeout : TIMEOUT_MIN;
+
+    // Every frame of the file has retries + 1 tries
+    double p = modelFrameError(line, payload);
+    double frames = tune->fileSize / best.chunk + 1;
+    best.retries = 1;
+    while (best.retries < MAX_RETRIES && frames * modelPower(p, best.retries + 1) > FILE_FAILURE)
+        best.retries++;
+
+    best.window = fillingWindow(line, best.chunk);
+    return best;
+}
+
+static void printSize(const t_line *line, int chunk, const char *note)
+{
+    int window = fillingWindow(line, chunk);
+    double sw = fileEfficiency(line, chunk, ARQ_STOP_AND_WAIT, 1);
+    printf("  %5d %5.2f%% %9.3f %9.0f %6d %8.4f %8.4f %8.4f  %s\n", chunk,
+           100 * modelFrameError(line, chunk + PACKET_HEADER), modelCycle(line, chunk + PACKET_HEADER),
+           sw * line->baudRate / 8, window, sw, fileEfficiency(line, chunk, ARQ_GO_BACK_N, window),
+           fileEfficiency(line, chunk, ARQ_SELECTIVE_REPEAT, window), note);
+}
+
+static int writeTuning(const char *path, const t_tune *tune, const t_settings *s)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+
+    fprintf(file, "# linktune: %d baud, %.3f ms propagation, ber %g, stuffing %.4f\n", tune->line.baudRate,
+            tune->line.prop * 1000, tune->line.ber, tune->line.stuffing);
+    fprintf(file, "LL_CHUNK=%d\nLL_TIMEOUT_MS=%.0f\nLL_RETRIES=%d\n", s->chunk, s->timeout * 1000, s->retries);
+    return fclose(file);
+}
+
+int main(int argc, char *argv[])
+{
+    t_tune tune = {.line = {.baudRate = 9600, .stuffing = RANDOM_STUFFING}, .fileSize = DEFAULT_FILE_SIZE,
+                   .stuffingFrom = "uniform data"};
+    const char *output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:b:d:e:f:s:w:")) != -1)
+    {
+        int ok = 1;
+        switch (opt)
+        {
+        case 'm':
+            ok = measure(&tune, optarg) == 0;
+            break;
+        case 'b':
+            tune.line.baudRate = atoi(optarg);
+            break;
+        case 'd':
+            tune.line.prop = atof(optarg) / 1000;
+            break;
+        case 'e':
+            tune.line.ber = atof(optarg);
+            break;
+        case 'f':
+            ok = sampleFile(&tune, optarg) == 0;
+            if (!ok)
+                printf("Couldn't sample '%s'!\n", optarg);
+            break;
+        case 's':
+            tune.fileSize = atof(optarg);
+            break;
+        case 'w':
+            output = optarg;
+            break;
+        default:
+            ok = 0;
+        }
+        if (!ok)
+        {
+            printf("Usage: %s [-m metrics.csv] [-b baud] [-d prop ms] [-e ber] [-f file] [-s file bytes] "
+                   "[-w tuning file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    t_line *line = &tune.line;
+    if (line->baudRate <= 0 || line->prop < 0 || line->ber < 0 || line->ber >= 0.5 || tune.fileSize <= 0)
+    {
+        printf("The line makes no sense!\n");
+        return 1;
+    }
+
+    printf("Line: %d baud, %.3f ms propagation, ber %g, stuffing %.2f%% (%s), %.0f byte file\n\n",
+           line->baudRate, line->prop * 1000, line->ber, 100 * line->stuffing,
+           tune.stuffingFrom, tune.fileSize);
+
+    t_settings best = recommend(&tune);
+    printf("  %5s %6s %9s %9s %6s %8s %8s %8s\n", "chunk", "fer", "1+2a", "B/s", "window", "s&w", "gbn", "sr");
+    static const int sizes[] = {64, 128, 256, DEFAULT_CHUNK, MAX_CHUNK};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        printSize(line, sizes[i], sizes[i] == DEFAULT_CHUNK ? "(default)" : "");
+    printSize(line, best.chunk, "(best)");
+
+    printf("\nRecommended: LL_CHUNK=%d LL_TIMEOUT_MS=%.0f LL_RETRIES=%d, window 1 (stop-and-wait)\n", best.chunk,
+           best.timeout * 1000, best.retries);
+    printf("Expected goodput %.0f B/s, %.1f%% of the line\n", best.efficiency * line->baudRate / 8,
+           100 * best.efficiency);
+    if (best.window > 1)
+        printf("A window of %d frames would fill the line: %.1f%% with go-back-N, %.1f%% with selective repeat\n",
+               best.window, 100 * fileEfficiency(line, best.chunk, ARQ_GO_BACK_N, best.window),
+               100 * fileEfficiency(line, best.chunk, ARQ_SELECTIVE_REPEAT, best.window));
+
+    if (output != NULL)
+    {
+        if (writeTuning(output, &tune, &best) != 0)
+        {
+            printf("Couldn't write '%s'!\n", output);
+            return 1;
+        }
+        printf("Written to '%s', use it with LL_TUNE=%s\n", output, output);
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Plays an LL_CAPTURE file back into a receiver: llopen on replay:<capture>,
+// llread until the capture runs out, then prints what came out and how fast.
+// The CRC32C of the packets read (and their channels) is a fingerprint to
+// compare receivers or decoders by on the same capture.
+//
+// Usage: replay [-t] [-n runs] <capture>
+//
+// -t keeps the original timing, otherwise the capture goes through as fast
+// as the receiver answers it. Decoder throughput alone on a capture is
+// measured by bin/decodebench.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "digest.h"
+#include "link_ext.h"
+#include "link_layer.h"
+#include "metrics.h"
+
+typedef struct s_replay_result
+{
+    size_t      packets;
+    uint64_t    bytes;
+    uint32_t    crc;
+    double      seconds;    // From llopen to the last packet
+    size_t      framesReceived;
+}   t_replay_result;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// What the capture holds, in each direction
+static int describe(const char *path)
+{
+    t_capture_reader reader;
+    if (captureReaderOpen(&reader, path) < 0)
+        return -1;
+
+    static t_capture_record record;
+    size_t records[2] = {0}, bytes[2] = {0};
+    int retv;
+    while ((retv = captureNext(&reader, &record)) > 0)
+    {
+        records[record.dir]++;
+        bytes[record.dir] += record.size;
+    }
+
+    time_t start = reader.header.start;
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&start));
+    printf("Capture of the %s at %" PRIu32 " baud, %s, %.3f s\n"
+           "  read:    %zu bytes in %zu spans\n"
+           "  written: %zu bytes in %zu spans\n",
+           reader.header.role == LlTx ? "transmitter" : "receiver", reader.header.baudRate, date, reader.time,
+           bytes[CAPTURE_READ], records[CAPTURE_READ], bytes[CAPTURE_WRITE], records[CAPTURE_WRITE]);
+    if (retv < 0)
+        printf("  (cut short)\n");
+
+    captureReaderClose(&reader);
+    return 0;
+}
+
+static int runOnce(const char *spec, int baudRate, t_replay_result *result)
+{
+    LinkLayer params = {.role = LlRx, .baudRate = baudRate, .nRetransmissions = 3, .timeout = 4};
+    snprintf(params.serialPort, sizeof(params.serialPort), "%s", spec);
+    memset(result, 0, sizeof(*result));
+
+    double start = now(), last = start;
+    if (llopen(params) < 0)
+        return -1;
+
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    uint8_t channel;
+    int size;
+    while ((size = llreadChannel(packet, &channel)) >= 0)
+    {
+        result->packets++;
+        result->bytes += size;
+        result->crc = crc32c(result->crc, &channel, 1);
+        result->crc = crc32c(result->crc, packet, size);
+        last = now();
+    }
+
+    result->seconds = last - start;
+    const t_metrics *m = llmetrics();
+    result->framesReceived = m->framesReceived;
+    llclose(FALSE);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int timed = 0, runs = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "tn:")) != -1)
+    {
+        if (opt == 't')
+            timed = 1;
+        else if (opt == 'n' && atoi(optarg) > 0)
+            runs = atoi(optarg);
+        else
+            optind = argc + 1;
+    }
+    if (optind != argc - 1)
+    {
+        printf("Usage: %s [-t] [-n runs] <capture>\n", argv[0]);
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    t_capture_reader reader;
+    if (captureReaderOpen(&reader, path) < 0)
+    {
+        printf("'%s' isn't a capture!\n", path);
+        return 1;
+    }
+    int baudRate = reader.header.baudRate;
+    captureReaderClose(&reader);
+    describe(path);
+
+    char spec[sizeof(((LinkLayer *)0)->serialPort)];
+    if (snprintf(spec, sizeof(spec), "replay:%s%s", path, timed ? ",timed" : "") >= (int)sizeof(spec))
+    {
+        printf("The capture's path is too long for a port name, copy it somewhere shorter\n");
+        return 1;
+    }
+
+    // The link's own messages would hide the results
+    setenv("LL_LOG", "warn", 0);
+
+    int differ = 0;
+    t_replay_result first = {0};
+    for (int i = 0; i < runs; i++)
+    {
+        t_replay_result r;
+        if (runOnce(spec, baudRate, &r) < 0)
+        {
+            printf("Couldn't open the link on '%s'!\n", spec);
+            return 1;
+        }
+
+        if (i == 0)
+            first = r;
+        differ |= r.packets != first.packets || r.crc != first.crc;
+        printf("run %d: %zu packets, %" PRIu64 " bytes, crc32c %08" PRIx32 ", %zu frames, %.3f s, "
+               "%.2f MB/s, %.0f packets/s\n", i + 1, r.packets, r.bytes, r.crc, r.framesReceived,
+               r.seconds, r.seconds > 0 ? r.bytes / r.seconds / 1e6 : 0, r.seconds > 0 ? r.packets / r.seconds : 0);
+    }
+
+    if (differ)
+        printf("The runs read different packets!\n");
+    return differ;
+}
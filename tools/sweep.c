@@ -0,0 +1,22 @@
+// Command line helpers of the sweeping tools, see sweep.h
+
+#include "sweep.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int parseList(t_list *list, const char *text)
+{
+    char *copy = strdup(text);
+    if (copy == NULL)
+        return -1;
+
+    list->count = 0;
+    for (char *value = strtok(copy, ","); value != NULL; value = strtok(NULL, ","))
+    {
+        if (list->count == MAX_VALUES)
+            return free(copy), -1;
+        list->values[list->count++] = atof(value);
+    }
+    return free(copy), list->count > 0 ? 0 : -1;
+}
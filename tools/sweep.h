@@ -0,0 +1,17 @@
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+// Values of a sweep given on the command line of bin/linkbench and bin/cablerun
+
+#define MAX_VALUES 16
+
+typedef struct s_list
+{
+    double  values[MAX_VALUES];
+    int     count;
+}   t_list;
+
+// Comma separated numbers, at least one and at most MAX_VALUES
+int     parseList(t_list *list, const char *text);
+
+#endif
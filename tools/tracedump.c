@@ -0,0 +1,73 @@
+// Converts the tracepoint rings written by a -DLL_TRACE build into the
+// Chrome trace format (chrome://tracing, Perfetto).
+//
+// Usage: tracedump [trace.bin] [trace.json]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int main(int argc, char *argv[])
+{
+    const char *inPath = argc > 1 ? argv[1] : "trace.bin";
+    const char *outPath = argc > 2 ? argv[2] : "trace.json";
+
+    FILE *in = fopen(inPath, "rb");
+    if (in == NULL)
+    {
+        printf("Couldn't open '%s'!\n", inPath);
+        return 1;
+    }
+
+    t_trace_header header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_MAGIC || header.ticksPerNs <= 0)
+    {
+        printf("'%s' is not a trace dump!\n", inPath);
+        return fclose(in), 1;
+    }
+
+    t_trace_event *events = malloc((header.count ? header.count : 1) * sizeof(t_trace_event));
+    if (events == NULL || fread(events, sizeof(t_trace_event), header.count, in) != header.count)
+    {
+        printf("Trace dump '%s' is truncated!\n", inPath);
+        return free(events), fclose(in), 1;
+    }
+    fclose(in);
+
+    FILE *out = fopen(outPath, "w");
+    if (out == NULL)
+    {
+        printf("Couldn't create '%s'!\n", outPath);
+        return free(events), 1;
+    }
+
+    // Timestamps start at the first event so they stay readable
+    uint64_t origin = UINT64_MAX;
+    for (uint32_t i = 0; i < header.count; i++)
+        if (events[i].start < origin)
+            origin = events[i].start;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        const t_trace_event *e = &events[i];
+        const char *name = e->stage < TR_STAGES ? traceStageNames[e->stage] : "unknown";
+        double ts = (e->start - origin) / header.ticksPerNs / 1000.0;
+        double dur = (e->end - e->start) / header.ticksPerNs / 1000.0;
+
+        if (e->stage == TR_RETRANSMIT)
+            fprintf(out, "  {\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %" PRIu32 "}",
+                    name, ts, e->tid);
+        else
+            fprintf(out, "  {\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %" PRIu32 "}",
+                    name, ts, dur, e->tid);
+        fprintf(out, i + 1 < header.count ? ",\n" : "\n");
+    }
+    fprintf(out, "]}\n");
+
+    printf("%" PRIu32 " events written to '%s'\n", header.count, outPath);
+    free(events);
+    return fclose(out) != 0;
+}